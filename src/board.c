@@ -0,0 +1,168 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "board.h"
+
+/*
+ * Board description files list the wing inputs and the outputs they drive,
+ * one directive per line, '#' starts a comment:
+ *
+ *	gpiochip <chip>			gpio chip of the LEDs
+ *	buttons <input>			buttons, followed by their keys
+ *	key <code> <line>		key code and its LED gpio line
+ *	slider <input>			slider, followed by its LEDs
+ *	wheel <input>			wheel, followed by its LEDs
+ *	led <line>			LED gpio line
+ *	matrix <x input> <y input>	2D surface displayed on an IS31FL3728
+ *	i2c <bus> <address>		i2c bus and address of the IS31FL3728
+ *	position <x input> <y input>	2D surface, positions printed
+ *
+ * Several files can be loaded in the same board, their devices are added
+ * to the ones already loaded.
+ */
+
+static const char * const board_device_types[] = {
+	[BOARD_BUTTONS] = "buttons",
+	[BOARD_SLIDER] = "slider",
+	[BOARD_WHEEL] = "wheel",
+	[BOARD_MATRIX] = "matrix",
+	[BOARD_POSITION] = "position",
+};
+
+const char *board_device_type_name(enum board_device_type type)
+{
+	return board_device_types[type];
+}
+
+static int board_parse_uint(const char *str, unsigned int *value)
+{
+	char *end;
+
+	if (!str)
+		return -1;
+
+	errno = 0;
+	*value = strtoul(str, &end, 0);
+	return errno || *end ? -1 : 0;
+}
+
+static int board_copy_path(char *dst, const char *src)
+{
+	if (!src || strlen(src) >= BOARD_PATH_MAX)
+		return -1;
+
+	strcpy(dst, src);
+	return 0;
+}
+
+static int board_parse_line(struct board *board, char *line)
+{
+	struct board_device *dev = board->ndevices ?
+		&board->devices[board->ndevices - 1] : NULL;
+	char *keyword, *arg1, *arg2;
+	unsigned int type, code, pin;
+
+	keyword = strtok(line, " \t\n");
+	if (!keyword)
+		return 0;
+	arg1 = strtok(NULL, " \t\n");
+	arg2 = strtok(NULL, " \t\n");
+
+	if (!strcmp(keyword, "gpiochip"))
+		return board_copy_path(board->gpiochip, arg1);
+
+	for (type = 0; type < sizeof(board_device_types) / sizeof(board_device_types[0]); type++) {
+		if (strcmp(keyword, board_device_types[type]))
+			continue;
+
+		if (board->ndevices == BOARD_MAX_DEVICES)
+			return -1;
+
+		dev = &board->devices[board->ndevices];
+		memset(dev, 0, sizeof(*dev));
+		dev->type = type;
+		if (board_copy_path(dev->input[0], arg1))
+			return -1;
+
+		if (type == BOARD_MATRIX || type == BOARD_POSITION) {
+			if (board_copy_path(dev->input[1], arg2))
+				return -1;
+		}
+
+		if (type == BOARD_MATRIX) {
+			strcpy(dev->i2c_file, BOARD_DEFAULT_I2C_FILE);
+			dev->i2c_addr = BOARD_DEFAULT_I2C_ADDR;
+		}
+
+		board->ndevices++;
+		return 0;
+	}
+
+	if (!dev)
+		return -1;
+
+	if (!strcmp(keyword, "key") && dev->type == BOARD_BUTTONS) {
+		if (board_parse_uint(arg1, &code) || board_parse_uint(arg2, &pin) ||
+		    dev->nleds == GPIO_LED_BANK_MAX_LEDS)
+			return -1;
+
+		dev->key_codes[dev->nleds] = code;
+		dev->leds[dev->nleds].led_id = dev->nleds;
+		dev->leds[dev->nleds].pin_id = pin;
+		dev->nleds++;
+		return 0;
+	}
+
+	if (!strcmp(keyword, "led") &&
+	    (dev->type == BOARD_SLIDER || dev->type == BOARD_WHEEL)) {
+		if (board_parse_uint(arg1, &pin) || dev->nleds == GPIO_LED_BANK_MAX_LEDS)
+			return -1;
+
+		dev->leds[dev->nleds].led_id = dev->nleds;
+		dev->leds[dev->nleds].pin_id = pin;
+		dev->nleds++;
+		return 0;
+	}
+
+	if (!strcmp(keyword, "i2c") && dev->type == BOARD_MATRIX) {
+		if (board_copy_path(dev->i2c_file, arg1) ||
+		    (arg2 && board_parse_uint(arg2, &dev->i2c_addr)))
+			return -1;
+		return 0;
+	}
+
+	return -1;
+}
+
+int board_load(struct board *board, const char *path)
+{
+	unsigned int lineno = 0;
+	char line[256], *comment;
+	FILE *f;
+	int ret = 0;
+
+	f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "Can't open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+
+		comment = strchr(line, '#');
+		if (comment)
+			*comment = '\0';
+
+		if (board_parse_line(board, line)) {
+			fprintf(stderr, "%s:%u: invalid directive\n", path, lineno);
+			ret = -1;
+			break;
+		}
+	}
+
+	fclose(f);
+	return ret;
+}
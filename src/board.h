@@ -0,0 +1,44 @@
+#ifndef _BOARD_H
+#define _BOARD_H
+
+#include "gpio_helper.h"
+
+#define BOARD_MAX_DEVICES	8
+#define BOARD_PATH_MAX		64
+#define BOARD_DEFAULT_I2C_FILE	"/dev/i2c-1"
+#define BOARD_DEFAULT_I2C_ADDR	0x60
+
+enum board_device_type {
+	BOARD_BUTTONS,
+	BOARD_SLIDER,
+	BOARD_WHEEL,
+	BOARD_MATRIX,
+	BOARD_POSITION,
+};
+
+/*
+ * One input of a wing and what it drives, resolved from the description
+ * file: key codes and LED lines for buttons, LED lines for sliders and
+ * wheels, the X and Y inputs of a 2D surface and, for a matrix, the
+ * IS31FL3728 it drives.
+ */
+struct board_device {
+	enum board_device_type type;
+	char input[2][BOARD_PATH_MAX];
+	unsigned int nleds;
+	unsigned int key_codes[GPIO_LED_BANK_MAX_LEDS];
+	struct gpio_led_desc leds[GPIO_LED_BANK_MAX_LEDS];
+	char i2c_file[BOARD_PATH_MAX];
+	unsigned int i2c_addr;
+};
+
+struct board {
+	char gpiochip[BOARD_PATH_MAX];
+	unsigned int ndevices;
+	struct board_device devices[BOARD_MAX_DEVICES];
+};
+
+int board_load(struct board *board, const char *path);
+const char *board_device_type_name(enum board_device_type type);
+
+#endif /* _BOARD_H */
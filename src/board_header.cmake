@@ -0,0 +1,122 @@
+# Generates the constant board tables of a demo from a board description
+# file of the boards folder, run at build time:
+#
+#	cmake -D BOARD_FILE=<board.conf> -D OUTPUT=<header> -P board_header.cmake
+#
+# The buttons, slider and wheel of the file become static const tables
+# named as the demos use them, with their sizes as macros:
+#
+#	BUTTONS_INPUT_FILE, NUMBER_OF_BUTTONS, buttons_keycodes, buttons_leds
+#	SLIDER_INPUT_FILE, SLIDER_NB_OF_LEDS, slider_leds
+#	WHEEL_INPUT_FILE, WHEEL_NB_OF_LEDS, wheel_leds
+#
+# The other directives need the runtime board of ptc_daemon and are
+# rejected.
+
+cmake_minimum_required(VERSION 3.23)
+
+if(NOT BOARD_FILE OR NOT OUTPUT)
+    message(FATAL_ERROR "usage: cmake -D BOARD_FILE=<board.conf> -D OUTPUT=<header> -P board_header.cmake")
+endif()
+
+# Same limit as a gpio_led_bank.
+set(max_leds 32)
+
+file(STRINGS ${BOARD_FILE} lines)
+
+set(device "")
+set(devices "")
+set(lineno 0)
+foreach(line IN LISTS lines)
+    math(EXPR lineno "${lineno} + 1")
+
+    # The comment of a key or LED line, e.g. its pin name, is kept.
+    set(comment "")
+    if(line MATCHES "#[ \t]*(.*[^ \t])")
+        set(comment "\t/* ${CMAKE_MATCH_1} */")
+    endif()
+    string(REGEX REPLACE "#.*" "" line "${line}")
+    string(STRIP "${line}" line)
+    if(line STREQUAL "")
+        continue()
+    endif()
+    string(REGEX REPLACE "[ \t]+" ";" args "${line}")
+    list(LENGTH args nargs)
+    list(GET args 0 keyword)
+
+    if(keyword MATCHES "^(buttons|slider|wheel)$")
+        if(NOT nargs EQUAL 2)
+            message(FATAL_ERROR "${BOARD_FILE}:${lineno}: ${keyword} takes an input file")
+        endif()
+        if(keyword IN_LIST devices)
+            message(FATAL_ERROR "${BOARD_FILE}:${lineno}: a single ${keyword} per demo")
+        endif()
+        set(device ${keyword})
+        list(APPEND devices ${device})
+        list(GET args 1 ${device}_input)
+        set(${device}_nleds 0)
+        set(${device}_keys "")
+        set(${device}_leds "")
+    elseif(keyword STREQUAL "key" AND device STREQUAL "buttons")
+        if(NOT nargs EQUAL 3)
+            message(FATAL_ERROR "${BOARD_FILE}:${lineno}: key takes a key code and a gpio line")
+        endif()
+        list(GET args 1 code)
+        list(GET args 2 pin)
+        string(APPEND buttons_keys "\t${code},${comment}\n")
+        string(APPEND buttons_leds "\t{ .led_id = ${buttons_nleds}, .pin_id = ${pin} },${comment}\n")
+        math(EXPR buttons_nleds "${buttons_nleds} + 1")
+    elseif(keyword STREQUAL "led" AND device MATCHES "^(slider|wheel)$")
+        if(NOT nargs EQUAL 2)
+            message(FATAL_ERROR "${BOARD_FILE}:${lineno}: led takes a gpio line")
+        endif()
+        list(GET args 1 pin)
+        string(APPEND ${device}_leds "\t{ .led_id = ${${device}_nleds}, .pin_id = ${pin} },${comment}\n")
+        math(EXPR ${device}_nleds "${${device}_nleds} + 1")
+    else()
+        message(FATAL_ERROR "${BOARD_FILE}:${lineno}: unsupported directive: ${line}")
+    endif()
+
+    if(device AND ${device}_nleds GREATER max_leds)
+        message(FATAL_ERROR "${BOARD_FILE}:${lineno}: more than ${max_leds} LEDs")
+    endif()
+endforeach()
+
+foreach(device IN ITEMS buttons slider wheel)
+    if(NOT device IN_LIST devices OR ${device}_nleds EQUAL 0)
+        message(FATAL_ERROR "${BOARD_FILE}: no ${device} or no LED for it")
+    endif()
+endforeach()
+
+get_filename_component(board_name ${BOARD_FILE} NAME)
+set(header "/* Generated from ${board_name} by board_header.cmake, don't edit. */
+
+#ifndef _BOARD_TABLES_H
+#define _BOARD_TABLES_H
+
+#include \"gpio_helper.h\"
+
+#define BUTTONS_INPUT_FILE\t\"${buttons_input}\"
+#define SLIDER_INPUT_FILE\t\"${slider_input}\"
+#define WHEEL_INPUT_FILE\t\"${wheel_input}\"
+
+#define NUMBER_OF_BUTTONS\t${buttons_nleds}
+#define SLIDER_NB_OF_LEDS\t${slider_nleds}
+#define WHEEL_NB_OF_LEDS\t${wheel_nleds}
+
+static const unsigned int buttons_keycodes[NUMBER_OF_BUTTONS] = {
+${buttons_keys}};
+
+static const struct gpio_led_desc buttons_leds[NUMBER_OF_BUTTONS] = {
+${buttons_leds}};
+
+static const struct gpio_led_desc slider_leds[SLIDER_NB_OF_LEDS] = {
+${slider_leds}};
+
+static const struct gpio_led_desc wheel_leds[WHEEL_NB_OF_LEDS] = {
+${wheel_leds}};
+
+#endif /* _BOARD_TABLES_H */
+")
+
+file(WRITE ${OUTPUT} "${header}")
@@ -0,0 +1,30 @@
+#ifndef _COUNTER_H
+#define _COUNTER_H
+
+#include <stdatomic.h>
+
+/*
+ * Always-on counters of the event and output paths. Each counter has a
+ * single writer, which updates it with a relaxed load and store rather
+ * than an atomic read-modify-write: no locked instruction nor barrier on
+ * the event path. Any thread can still read whole values, e.g. to export
+ * them while the output thread of a pipeline keeps counting.
+ */
+static inline void counter_add(atomic_ulong *counter, unsigned long n)
+{
+	atomic_store_explicit(counter,
+			      atomic_load_explicit(counter, memory_order_relaxed) + n,
+			      memory_order_relaxed);
+}
+
+static inline void counter_inc(atomic_ulong *counter)
+{
+	counter_add(counter, 1);
+}
+
+static inline unsigned long counter_read(const atomic_ulong *counter)
+{
+	return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+#endif /* _COUNTER_H */
@@ -0,0 +1,705 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#include "event_loop.h"
+
+#define EVENT_LOOP_MAX_EVENTS	16
+#define EVENT_LOOP_URING_ENTRIES	128
+#define EVENT_LOOP_MAX_WRITES	64
+
+/*
+ * io_uring user data: a source for its poll or read completion, tagged for
+ * the poll a read is linked to, a pending write, or NULL when the completion
+ * is not waited for.
+ */
+#define EVENT_LOOP_TAG_POLL	0x1UL
+#define EVENT_LOOP_TAG_WRITE	0x2UL
+#define EVENT_LOOP_TAG_MASK	0x3UL
+
+enum event_source_type {
+	EVENT_SOURCE_FD,
+	EVENT_SOURCE_TIMER,
+	EVENT_SOURCE_SIGNAL,
+	EVENT_SOURCE_READ,
+};
+
+struct event_source {
+	enum event_source_type type;
+	int fd;
+	int priority;
+	int signo;
+	int (*fd_handler)(int fd, uint32_t events, void *arg);
+	int (*timer_handler)(void *arg);
+	int (*signal_handler)(int signo, void *arg);
+	void *(*read_buffer)(void *arg, size_t *size);
+	int (*read_handler)(int fd, ssize_t len, void *arg);
+	void *arg;
+	/* io_uring requests in flight for this source. */
+	unsigned int armed;
+	bool removed;
+	struct event_source *next;
+};
+
+struct event_write {
+	void (*done)(int res, void *arg);
+	void *arg;
+	struct event_write *next;
+};
+
+struct event_loop {
+	int epfd;
+	bool quit;
+	int status;
+	struct event_source *sources;
+	/*
+	 * Sources removed while dispatching, freed once the batch is done and,
+	 * with io_uring, their requests completed.
+	 */
+	struct event_source *removed;
+#ifdef HAVE_LIBURING
+	bool uring;
+	struct io_uring ring;
+	struct event_write writes[EVENT_LOOP_MAX_WRITES];
+	struct event_write *free_writes;
+#endif
+};
+
+struct event_loop *event_loop_new(void)
+{
+	struct event_loop *loop;
+
+	loop = calloc(1, sizeof(*loop));
+	if (!loop) {
+		fprintf(stderr, "Can't allocate event loop\n");
+		return NULL;
+	}
+
+	loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epfd < 0) {
+		fprintf(stderr, "epoll_create1() failed: %s\n", strerror(errno));
+		free(loop);
+		return NULL;
+	}
+
+	return loop;
+}
+
+struct event_loop *event_loop_new_uring(void)
+{
+	struct event_loop *loop;
+#ifdef HAVE_LIBURING
+	unsigned int i;
+	int ret;
+#endif
+
+	loop = event_loop_new();
+	if (!loop)
+		return NULL;
+
+#ifdef HAVE_LIBURING
+	ret = io_uring_queue_init(EVENT_LOOP_URING_ENTRIES, &loop->ring, 0);
+	if (ret < 0) {
+		fprintf(stderr, "io_uring not available (%s), using epoll\n",
+			strerror(-ret));
+		return loop;
+	}
+
+	loop->uring = true;
+	for (i = 0; i < EVENT_LOOP_MAX_WRITES; i++) {
+		loop->writes[i].next = loop->free_writes;
+		loop->free_writes = &loop->writes[i];
+	}
+#else
+	fprintf(stderr, "built without io_uring, using epoll\n");
+#endif
+
+	return loop;
+}
+
+bool event_loop_is_uring(const struct event_loop *loop)
+{
+#ifdef HAVE_LIBURING
+	return loop->uring;
+#else
+	return false;
+#endif
+}
+
+static void event_source_free(struct event_source *source)
+{
+	/* Timer and signal fds belong to the loop, other fds to the caller. */
+	if (source->type == EVENT_SOURCE_TIMER ||
+	    source->type == EVENT_SOURCE_SIGNAL)
+		close(source->fd);
+
+	free(source);
+}
+
+static void event_loop_free_removed(struct event_loop *loop)
+{
+	struct event_source *source, **p = &loop->removed;
+
+	while ((source = *p)) {
+		/* Wait for the cancellation of its requests. */
+		if (source->armed) {
+			p = &source->next;
+			continue;
+		}
+
+		*p = source->next;
+		event_source_free(source);
+	}
+}
+
+void event_loop_free(struct event_loop *loop)
+{
+	struct event_source *source;
+
+	if (!loop)
+		return;
+
+#ifdef HAVE_LIBURING
+	/* Nothing can complete once the ring is gone. */
+	if (loop->uring)
+		io_uring_queue_exit(&loop->ring);
+#endif
+
+	while ((source = loop->sources)) {
+		loop->sources = source->next;
+		event_source_free(source);
+	}
+	while ((source = loop->removed)) {
+		loop->removed = source->next;
+		event_source_free(source);
+	}
+
+	close(loop->epfd);
+	free(loop);
+}
+
+#ifdef HAVE_LIBURING
+static struct io_uring_sqe *event_loop_get_sqe(struct event_loop *loop)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = io_uring_get_sqe(&loop->ring);
+	if (!sqe) {
+		/* Submission queue full, make room. */
+		io_uring_submit(&loop->ring);
+		sqe = io_uring_get_sqe(&loop->ring);
+	}
+
+	return sqe;
+}
+
+/*
+ * Wait for the source fd to be readable with a one shot poll, rearmed after
+ * each dispatch. Reads are linked to the poll: the device fds are non
+ * blocking, a read alone would fail with EAGAIN instead of waiting.
+ */
+static int event_loop_arm(struct event_loop *loop, struct event_source *source)
+{
+	struct io_uring_sqe *sqe;
+	size_t size;
+	void *buf;
+
+	sqe = event_loop_get_sqe(loop);
+	if (!sqe)
+		return -1;
+
+	io_uring_prep_poll_add(sqe, source->fd, POLLIN);
+	source->armed++;
+	if (source->type != EVENT_SOURCE_READ) {
+		io_uring_sqe_set_data(sqe, source);
+		return 0;
+	}
+
+	io_uring_sqe_set_data(sqe, (void *)((uintptr_t)source | EVENT_LOOP_TAG_POLL));
+	io_uring_sqe_set_flags(sqe, IOSQE_IO_LINK);
+
+	sqe = event_loop_get_sqe(loop);
+	if (!sqe)
+		return -1;
+
+	buf = source->read_buffer(source->arg, &size);
+	io_uring_prep_read(sqe, source->fd, buf, size, -1);
+	io_uring_sqe_set_data(sqe, source);
+	source->armed++;
+
+	return 0;
+}
+
+static void event_loop_cancel(struct event_loop *loop, void *user_data)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = event_loop_get_sqe(loop);
+	if (!sqe)
+		return;
+
+	io_uring_prep_cancel(sqe, user_data, 0);
+	io_uring_sqe_set_data(sqe, NULL);
+}
+#endif
+
+static struct event_source *event_loop_add(struct event_loop *loop,
+	enum event_source_type type, int fd, uint32_t events, int priority,
+	void *arg)
+{
+	struct epoll_event ev = { 0 };
+	struct event_source *source;
+
+	source = calloc(1, sizeof(*source));
+	if (!source) {
+		fprintf(stderr, "Can't allocate event source\n");
+		return NULL;
+	}
+
+	source->type = type;
+	source->fd = fd;
+	source->priority = priority;
+	source->arg = arg;
+
+#ifdef HAVE_LIBURING
+	/* Armed by event_loop_run(), once the handlers are set. */
+	if (loop->uring) {
+		source->next = loop->sources;
+		loop->sources = source;
+		return source;
+	}
+#endif
+
+	ev.events = events;
+	ev.data.ptr = source;
+	if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev)) {
+		fprintf(stderr, "Can't add fd %d to the event loop: %s\n",
+			fd, strerror(errno));
+		free(source);
+		return NULL;
+	}
+
+	source->next = loop->sources;
+	loop->sources = source;
+
+	return source;
+}
+
+struct event_source *event_loop_add_fd(struct event_loop *loop, int fd,
+	unsigned int flags, int priority,
+	int (*handler)(int fd, uint32_t events, void *arg), void *arg)
+{
+	struct event_source *source;
+	uint32_t events = EPOLLIN;
+
+	if (flags & EVENT_LOOP_EDGE_TRIGGERED)
+		events |= EPOLLET;
+
+	source = event_loop_add(loop, EVENT_SOURCE_FD, fd, events, priority, arg);
+	if (source)
+		source->fd_handler = handler;
+
+	return source;
+}
+
+struct event_source *event_loop_add_read(struct event_loop *loop, int fd,
+	int priority, void *(*buffer)(void *arg, size_t *size),
+	int (*handler)(int fd, ssize_t len, void *arg), void *arg)
+{
+	struct event_source *source;
+
+	source = event_loop_add(loop, EVENT_SOURCE_READ, fd, EPOLLIN, priority, arg);
+	if (source) {
+		source->read_buffer = buffer;
+		source->read_handler = handler;
+	}
+
+	return source;
+}
+
+struct event_source *event_loop_add_timer(struct event_loop *loop,
+	unsigned int period_ms, int priority,
+	int (*handler)(void *arg), void *arg)
+{
+	struct itimerspec its = { 0 };
+	struct event_source *source;
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "timerfd_create() failed: %s\n", strerror(errno));
+		return NULL;
+	}
+
+	its.it_interval.tv_sec = period_ms / 1000;
+	its.it_interval.tv_nsec = (period_ms % 1000) * 1000000L;
+	its.it_value = its.it_interval;
+	if (timerfd_settime(fd, 0, &its, NULL)) {
+		fprintf(stderr, "timerfd_settime() failed: %s\n", strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	source = event_loop_add(loop, EVENT_SOURCE_TIMER, fd, EPOLLIN, priority, arg);
+	if (!source) {
+		close(fd);
+		return NULL;
+	}
+	source->timer_handler = handler;
+
+	return source;
+}
+
+struct event_source *event_loop_add_signal(struct event_loop *loop,
+	int signo, int priority,
+	int (*handler)(int signo, void *arg), void *arg)
+{
+	struct event_source *source;
+	sigset_t mask, old_mask;
+	int fd;
+
+	/* The signal is only delivered through the signalfd from now on. */
+	sigemptyset(&mask);
+	sigaddset(&mask, signo);
+	if (sigprocmask(SIG_BLOCK, &mask, &old_mask)) {
+		fprintf(stderr, "Can't block signal %d\n", signo);
+		return NULL;
+	}
+
+	fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "signalfd() failed: %s\n", strerror(errno));
+		goto out;
+	}
+
+	source = event_loop_add(loop, EVENT_SOURCE_SIGNAL, fd, EPOLLIN, priority, arg);
+	if (!source) {
+		close(fd);
+		goto out;
+	}
+	source->signo = signo;
+	source->signal_handler = handler;
+
+	return source;
+
+out:
+	/* Not handled by the loop: its default disposition is back. */
+	sigprocmask(SIG_SETMASK, &old_mask, NULL);
+	return NULL;
+}
+
+void event_loop_remove(struct event_loop *loop, struct event_source *source)
+{
+	struct event_source **p;
+
+	if (!source)
+		return;
+
+	for (p = &loop->sources; *p; p = &(*p)->next) {
+		if (*p == source) {
+			*p = source->next;
+			break;
+		}
+	}
+
+#ifdef HAVE_LIBURING
+	if (loop->uring) {
+		if (source->armed && source->type == EVENT_SOURCE_READ)
+			event_loop_cancel(loop, (void *)((uintptr_t)source | EVENT_LOOP_TAG_POLL));
+		if (source->armed)
+			event_loop_cancel(loop, source);
+	} else
+#endif
+	epoll_ctl(loop->epfd, EPOLL_CTL_DEL, source->fd, NULL);
+
+	/*
+	 * The source may still be referenced by the batch being dispatched,
+	 * defer freeing it.
+	 */
+	source->removed = true;
+	source->next = loop->removed;
+	loop->removed = source;
+}
+
+int event_loop_write(struct event_loop *loop, int fd, const void *buf,
+	size_t len, unsigned int flags,
+	void (*done)(int res, void *arg), void *arg)
+{
+	ssize_t ret;
+
+#ifdef HAVE_LIBURING
+	if (loop->uring) {
+		struct io_uring_sqe *sqe;
+		struct event_write *write = NULL;
+
+		if (done) {
+			write = loop->free_writes;
+			if (!write) {
+				fprintf(stderr, "Too many writes in flight\n");
+				return -1;
+			}
+			loop->free_writes = write->next;
+			write->done = done;
+			write->arg = arg;
+		}
+
+		sqe = event_loop_get_sqe(loop);
+		if (!sqe) {
+			if (write) {
+				write->next = loop->free_writes;
+				loop->free_writes = write;
+			}
+			return -1;
+		}
+
+		io_uring_prep_write(sqe, fd, buf, len, -1);
+		io_uring_sqe_set_data(sqe, write ?
+			(void *)((uintptr_t)write | EVENT_LOOP_TAG_WRITE) : NULL);
+		if (flags & EVENT_LOOP_WRITE_LINK)
+			io_uring_sqe_set_flags(sqe, IOSQE_IO_LINK);
+
+		return 0;
+	}
+#endif
+
+	ret = write(fd, buf, len);
+	if (done)
+		done(ret < 0 ? -errno : ret, arg);
+
+	return ret < 0 ? -1 : 0;
+}
+
+void event_loop_quit(struct event_loop *loop, int status)
+{
+	loop->quit = true;
+	loop->status = status;
+}
+
+/* epoll read source: read until EAGAIN, handing over each chunk. */
+static int event_source_read(struct event_source *source)
+{
+	ssize_t len;
+	size_t size;
+	void *buf;
+	int ret;
+
+	for (;;) {
+		buf = source->read_buffer(source->arg, &size);
+		len = read(source->fd, buf, size);
+		if (len < 0 && errno == EAGAIN)
+			return 0;
+
+		ret = source->read_handler(source->fd, len < 0 ? -errno : len,
+					   source->arg);
+		if (ret || len <= 0)
+			return ret;
+	}
+}
+
+static int event_source_dispatch(struct event_source *source, uint32_t events)
+{
+	struct signalfd_siginfo ssi;
+	uint64_t expirations;
+
+	switch (source->type) {
+	case EVENT_SOURCE_FD:
+		return source->fd_handler(source->fd, events, source->arg);
+	case EVENT_SOURCE_TIMER:
+		if (read(source->fd, &expirations, sizeof(expirations)) < 0)
+			return errno == EAGAIN ? 0 : -1;
+		return source->timer_handler(source->arg);
+	case EVENT_SOURCE_SIGNAL:
+		if (read(source->fd, &ssi, sizeof(ssi)) != sizeof(ssi))
+			return errno == EAGAIN ? 0 : -1;
+		return source->signal_handler(source->signo, source->arg);
+	case EVENT_SOURCE_READ:
+		return event_source_read(source);
+	}
+
+	return -1;
+}
+
+static void event_loop_sort(struct epoll_event *events, int n)
+{
+	struct event_source *source;
+	struct epoll_event tmp;
+	int i, j;
+
+	/* Insertion sort, batches are small and most often already sorted. */
+	for (i = 1; i < n; i++) {
+		tmp = events[i];
+		source = tmp.data.ptr;
+		for (j = i; j > 0; j--) {
+			struct event_source *prev = events[j - 1].data.ptr;
+
+			if (prev->priority >= source->priority)
+				break;
+			events[j] = events[j - 1];
+		}
+		events[j] = tmp;
+	}
+}
+
+#ifdef HAVE_LIBURING
+struct event_loop_completion {
+	struct event_source *source;
+	int res;
+};
+
+static void event_loop_sort_completions(struct event_loop_completion *comps, int n)
+{
+	struct event_loop_completion tmp;
+	int i, j;
+
+	for (i = 1; i < n; i++) {
+		tmp = comps[i];
+		for (j = i; j > 0; j--) {
+			if (comps[j - 1].source->priority >= tmp.source->priority)
+				break;
+			comps[j] = comps[j - 1];
+		}
+		comps[j] = tmp;
+	}
+}
+
+static int event_source_complete(struct event_source *source, int res)
+{
+	if (source->type == EVENT_SOURCE_READ) {
+		/* Spurious wakeup, or the poll failed and cancelled the read. */
+		if (res == -EAGAIN || res == -ECANCELED)
+			return 0;
+		return source->read_handler(source->fd, res, source->arg);
+	}
+
+	if (res < 0) {
+		fprintf(stderr, "poll of fd %d failed: %s\n", source->fd,
+			strerror(-res));
+		return -1;
+	}
+
+	return event_source_dispatch(source, res);
+}
+
+static int event_loop_run_uring(struct event_loop *loop)
+{
+	struct event_loop_completion comps[EVENT_LOOP_MAX_EVENTS];
+	struct io_uring_cqe *cqes[EVENT_LOOP_MAX_EVENTS];
+	struct event_source *source;
+	struct event_write *write;
+	uintptr_t data;
+	int i, n, m, ret;
+
+	for (source = loop->sources; source; source = source->next)
+		if (!source->armed && event_loop_arm(loop, source))
+			return -1;
+
+	while (!loop->quit) {
+		/* Submits the rearmed polls and reads and the queued writes. */
+		ret = io_uring_submit_and_wait(&loop->ring, 1);
+		if (ret < 0) {
+			if (ret == -EINTR)
+				continue;
+			fprintf(stderr, "io_uring_submit_and_wait() failed: %s\n",
+				strerror(-ret));
+			return -1;
+		}
+
+		n = io_uring_peek_batch_cqe(&loop->ring, cqes, EVENT_LOOP_MAX_EVENTS);
+		for (i = 0, m = 0; i < n; i++) {
+			data = (uintptr_t)io_uring_cqe_get_data(cqes[i]);
+			if (!data)
+				continue;
+
+			if (data & EVENT_LOOP_TAG_WRITE) {
+				write = (void *)(data & ~EVENT_LOOP_TAG_MASK);
+				write->done(cqes[i]->res, write->arg);
+				write->next = loop->free_writes;
+				loop->free_writes = write;
+				continue;
+			}
+
+			source = (void *)(data & ~EVENT_LOOP_TAG_MASK);
+			source->armed--;
+			if (data & EVENT_LOOP_TAG_POLL)
+				continue;
+
+			comps[m].source = source;
+			comps[m].res = cqes[i]->res;
+			m++;
+		}
+		io_uring_cq_advance(&loop->ring, n);
+
+		event_loop_sort_completions(comps, m);
+
+		for (i = 0; i < m && !loop->quit; i++) {
+			source = comps[i].source;
+			if (source->removed)
+				continue;
+
+			ret = event_source_complete(source, comps[i].res);
+			if (ret)
+				event_loop_quit(loop, ret);
+			else if (!source->removed && !source->armed &&
+				 event_loop_arm(loop, source))
+				event_loop_quit(loop, -1);
+		}
+
+		event_loop_free_removed(loop);
+	}
+
+	return loop->status;
+}
+#endif
+
+int event_loop_run(struct event_loop *loop)
+{
+	struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+	struct event_source *source;
+	int i, n, ret;
+
+	loop->quit = false;
+	loop->status = 0;
+
+#ifdef HAVE_LIBURING
+	if (loop->uring)
+		return event_loop_run_uring(loop);
+#endif
+
+	while (!loop->quit) {
+		n = epoll_wait(loop->epfd, events, EVENT_LOOP_MAX_EVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "epoll_wait() failed: %s\n", strerror(errno));
+			return -1;
+		}
+
+		event_loop_sort(events, n);
+
+		for (i = 0; i < n && !loop->quit; i++) {
+			source = events[i].data.ptr;
+			if (source->removed)
+				continue;
+
+			ret = event_source_dispatch(source, events[i].events);
+			if (ret)
+				event_loop_quit(loop, ret);
+		}
+
+		event_loop_free_removed(loop);
+	}
+
+	return loop->status;
+}
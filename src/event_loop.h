@@ -0,0 +1,72 @@
+#ifndef _EVENT_LOOP_H
+#define _EVENT_LOOP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Flags for event_loop_add_fd(). */
+#define EVENT_LOOP_EDGE_TRIGGERED	(1 << 0)
+
+/* Flags for event_loop_write(). */
+#define EVENT_LOOP_WRITE_LINK		(1 << 0)
+
+struct event_loop;
+struct event_source;
+
+/*
+ * epoll based event loop shared by the demos. Every source carries its own
+ * handler so dispatching a ready fd costs the same whatever the number of
+ * devices. When several sources are ready at once, they are dispatched by
+ * decreasing priority.
+ *
+ * Handlers return 0 to keep the loop running. Any other value stops
+ * event_loop_run() which returns it: by convention a negative value is an
+ * error and a positive one a normal termination.
+ *
+ * event_loop_new_uring() creates a loop based on io_uring instead, when
+ * built with liburing and supported by the kernel, and falls back to epoll
+ * otherwise. Read sources then have their reads done by the kernel and
+ * queued writes are submitted together with the next wait, so that a loop
+ * pass costs a single io_uring_enter().
+ */
+struct event_loop *event_loop_new(void);
+struct event_loop *event_loop_new_uring(void);
+bool event_loop_is_uring(const struct event_loop *loop);
+void event_loop_free(struct event_loop *loop);
+
+struct event_source *event_loop_add_fd(struct event_loop *loop, int fd,
+	unsigned int flags, int priority,
+	int (*handler)(int fd, uint32_t events, void *arg), void *arg);
+struct event_source *event_loop_add_timer(struct event_loop *loop,
+	unsigned int period_ms, int priority,
+	int (*handler)(void *arg), void *arg);
+struct event_source *event_loop_add_signal(struct event_loop *loop,
+	int signo, int priority,
+	int (*handler)(int signo, void *arg), void *arg);
+
+/*
+ * Read source: handler receives what was read into the buffer returned by
+ * buffer, or a negative errno. With epoll, the fd has to be non blocking and
+ * is read until EAGAIN.
+ */
+struct event_source *event_loop_add_read(struct event_loop *loop, int fd,
+	int priority, void *(*buffer)(void *arg, size_t *size),
+	int (*handler)(int fd, ssize_t len, void *arg), void *arg);
+void event_loop_remove(struct event_loop *loop, struct event_source *source);
+
+/*
+ * Write buf to fd, from the loop. With io_uring the write is only queued:
+ * buf must stay valid until done is called, and EVENT_LOOP_WRITE_LINK
+ * chains it to the next write so that they run in order. With epoll the
+ * write is done, and done called, before returning.
+ */
+int event_loop_write(struct event_loop *loop, int fd, const void *buf,
+	size_t len, unsigned int flags,
+	void (*done)(int res, void *arg), void *arg);
+
+int event_loop_run(struct event_loop *loop);
+void event_loop_quit(struct event_loop *loop, int status);
+
+#endif /* _EVENT_LOOP_H */
@@ -0,0 +1,306 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <libevdev-1.0/libevdev/libevdev.h>
+
+#include "event_trace.h"
+
+/* Records buffered before being appended to the file. */
+#define EVENT_TRACE_BUFFER_SIZE		(4096 * sizeof(struct event_trace_record))
+
+static unsigned long long event_trace_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void event_trace_describe(struct event_trace_device *desc,
+				 struct libevdev *evdev, const char *path)
+{
+	const struct input_absinfo *info;
+	unsigned int code;
+
+	snprintf(desc->name, sizeof(desc->name), "%s", libevdev_get_name(evdev));
+	snprintf(desc->path, sizeof(desc->path), "%s", path);
+	desc->id.bustype = libevdev_get_id_bustype(evdev);
+	desc->id.vendor = libevdev_get_id_vendor(evdev);
+	desc->id.product = libevdev_get_id_product(evdev);
+	desc->id.version = libevdev_get_id_version(evdev);
+
+	for (code = 0; code < KEY_CNT && desc->nkeys < EVENT_TRACE_MAX_KEYS; code++)
+		if (libevdev_has_event_code(evdev, EV_KEY, code))
+			desc->keys[desc->nkeys++] = code;
+
+	for (code = 0; code < ABS_CNT && desc->nabs < EVENT_TRACE_MAX_ABS; code++) {
+		info = libevdev_get_abs_info(evdev, code);
+		if (!info)
+			continue;
+
+		desc->abs[desc->nabs].code = code;
+		desc->abs[desc->nabs].info = *info;
+		desc->nabs++;
+	}
+}
+
+int event_trace_writer_open(struct event_trace_writer *writer, const char *path,
+			    struct libevdev **evdevs, const char **paths,
+			    unsigned int ndevices)
+{
+	struct event_trace_header *header;
+	unsigned int i;
+
+	if (ndevices > EVENT_TRACE_MAX_DEVICES) {
+		fprintf(stderr, "Can't trace more than %d devices\n",
+			EVENT_TRACE_MAX_DEVICES);
+		return -1;
+	}
+
+	header = calloc(1, sizeof(*header));
+	if (!header) {
+		fprintf(stderr, "Can't allocate trace header\n");
+		return -1;
+	}
+
+	memcpy(header->magic, EVENT_TRACE_MAGIC, sizeof(header->magic));
+	header->version = EVENT_TRACE_VERSION;
+	header->ndevices = ndevices;
+	header->start_us = writer->start_us = event_trace_now_us();
+	for (i = 0; i < ndevices; i++)
+		event_trace_describe(&header->devices[i], evdevs[i], paths[i]);
+
+	writer->nrecords = 0;
+	writer->file = fopen(path, "wb");
+	if (!writer->file) {
+		fprintf(stderr, "Can't create %s: %s\n", path, strerror(errno));
+		free(header);
+		return -1;
+	}
+	setvbuf(writer->file, NULL, _IOFBF, EVENT_TRACE_BUFFER_SIZE);
+
+	if (fwrite(header, sizeof(*header), 1, writer->file) != 1 ||
+	    fflush(writer->file)) {
+		fprintf(stderr, "Can't write %s header\n", path);
+		free(header);
+		fclose(writer->file);
+		return -1;
+	}
+
+	free(header);
+	return 0;
+}
+
+int event_trace_write(struct event_trace_writer *writer, unsigned int device,
+		      const struct input_event *events, unsigned int nevents)
+{
+	struct event_trace_record record;
+	unsigned long long us;
+	unsigned int i;
+
+	for (i = 0; i < nevents; i++) {
+		us = events[i].time.tv_sec * 1000000ULL + events[i].time.tv_usec;
+
+		record.time_us = us > writer->start_us ? us - writer->start_us : 0;
+		record.device = device;
+		record.type = events[i].type;
+		record.code = events[i].code;
+		record.value = events[i].value;
+		if (fwrite(&record, sizeof(record), 1, writer->file) != 1) {
+			fprintf(stderr, "Can't write trace record\n");
+			return -1;
+		}
+	}
+	writer->nrecords += nevents;
+
+	return 0;
+}
+
+int event_trace_writer_flush(struct event_trace_writer *writer)
+{
+	return fflush(writer->file) ? -1 : 0;
+}
+
+void event_trace_writer_close(struct event_trace_writer *writer)
+{
+	if (writer->file) {
+		fclose(writer->file);
+		writer->file = NULL;
+	}
+}
+
+int event_trace_open(struct event_trace *trace, const char *path)
+{
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "Can't open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof(struct event_trace_header)) {
+		fprintf(stderr, "%s is not a PTC trace\n", path);
+		close(fd);
+		return -1;
+	}
+
+	trace->size = st.st_size;
+	trace->map = mmap(NULL, trace->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (trace->map == MAP_FAILED) {
+		fprintf(stderr, "Can't map %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	trace->header = trace->map;
+	if (memcmp(trace->header->magic, EVENT_TRACE_MAGIC, sizeof(trace->header->magic)) ||
+	    trace->header->version != EVENT_TRACE_VERSION ||
+	    trace->header->ndevices > EVENT_TRACE_MAX_DEVICES) {
+		fprintf(stderr, "%s is not a supported PTC trace\n", path);
+		munmap(trace->map, trace->size);
+		return -1;
+	}
+
+	trace->records = (const void *)(trace->header + 1);
+	trace->nrecords = (trace->size - sizeof(*trace->header)) /
+			  sizeof(struct event_trace_record);
+
+	return 0;
+}
+
+void event_trace_close(struct event_trace *trace)
+{
+	if (trace->map && trace->map != MAP_FAILED)
+		munmap(trace->map, trace->size);
+	trace->map = NULL;
+}
+
+/*
+ * Create a uinput device per recorded device, with the same name, so that
+ * initialize_scroller() accepts them as PTC devices.
+ */
+int event_trace_create_devices(const struct event_trace *trace,
+			       struct uinput_device *devs)
+{
+	const struct event_trace_device *desc;
+	struct uinput_abs abs[EVENT_TRACE_MAX_ABS];
+	unsigned int keys[EVENT_TRACE_MAX_KEYS];
+	unsigned int i, j;
+
+	for (i = 0; i < trace->header->ndevices; i++) {
+		desc = &trace->header->devices[i];
+
+		for (j = 0; j < desc->nkeys && j < EVENT_TRACE_MAX_KEYS; j++)
+			keys[j] = desc->keys[j];
+		for (j = 0; j < desc->nabs && j < EVENT_TRACE_MAX_ABS; j++) {
+			abs[j].code = desc->abs[j].code;
+			abs[j].info = desc->abs[j].info;
+		}
+
+		if (uinput_create(&devs[i], desc->name, &desc->id,
+				  keys, desc->nkeys, abs, desc->nabs)) {
+			while (i--)
+				uinput_destroy(&devs[i]);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+void event_trace_destroy_devices(const struct event_trace *trace,
+				 struct uinput_device *devs)
+{
+	unsigned int i;
+
+	for (i = 0; i < trace->header->ndevices; i++)
+		uinput_destroy(&devs[i]);
+}
+
+static void event_trace_sleep_until(unsigned long long us)
+{
+	struct timespec ts = {
+		.tv_sec = us / 1000000,
+		.tv_nsec = (us % 1000000) * 1000,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+/*
+ * Feed the recorded events to the uinput devices, speed times faster than
+ * recorded, or as fast as possible if speed is 0. The events of a frame are
+ * injected with a single write.
+ */
+int event_trace_replay(const struct event_trace *trace,
+		       struct uinput_device *devs, double speed)
+{
+	struct input_event frame[64];
+	const struct event_trace_record *rec;
+	unsigned long long start_us = 0, first_us = 0;
+	unsigned int n = 0, device = 0;
+	size_t i;
+
+	if (!trace->nrecords)
+		return 0;
+
+	/*
+	 * The records of each device are in order, but those of different
+	 * devices are interleaved as they were read: the earliest timestamp
+	 * may not be the first one.
+	 */
+	first_us = trace->records[0].time_us;
+	for (i = 1; i < trace->nrecords; i++)
+		if (trace->records[i].time_us < first_us)
+			first_us = trace->records[i].time_us;
+	start_us = event_trace_now_us();
+
+	for (i = 0; i < trace->nrecords; i++) {
+		rec = &trace->records[i];
+		if (rec->device >= trace->header->ndevices)
+			continue;
+
+		/* Let the kernel generate its own overflows. */
+		if (rec->type == EV_SYN && rec->code == SYN_DROPPED)
+			continue;
+
+		if (n && (rec->device != device || n == sizeof(frame) / sizeof(frame[0]))) {
+			if (uinput_emit(&devs[device], frame, n))
+				return -1;
+			n = 0;
+		}
+
+		/* Older than a record of another device already replayed: at once. */
+		if (!n && speed > 0)
+			event_trace_sleep_until(start_us +
+				(unsigned long long)((rec->time_us - first_us) / speed));
+
+		device = rec->device;
+		memset(&frame[n], 0, sizeof(frame[n]));
+		frame[n].type = rec->type;
+		frame[n].code = rec->code;
+		frame[n].value = rec->value;
+		n++;
+
+		if (rec->type == EV_SYN && rec->code == SYN_REPORT) {
+			if (uinput_emit(&devs[device], frame, n))
+				return -1;
+			n = 0;
+		}
+	}
+
+	if (n && uinput_emit(&devs[device], frame, n))
+		return -1;
+
+	return 0;
+}
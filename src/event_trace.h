@@ -0,0 +1,93 @@
+#ifndef _EVENT_TRACE_H
+#define _EVENT_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <linux/input.h>
+
+#include "uinput_helper.h"
+
+/*
+ * Binary trace of PTC input devices.
+ *
+ * A fixed size header describes the recorded devices, it is followed by
+ * 16 byte records, one per input event, appended as they are read. The file
+ * is valid at any time while recording and can be mapped as is: records
+ * start at sizeof(struct event_trace_header), a truncated last record is
+ * ignored. Times are microseconds since the start of the recording, taken
+ * from the CLOCK_MONOTONIC event timestamps. Native endianness.
+ */
+#define EVENT_TRACE_MAGIC		"PTCTRACE"
+#define EVENT_TRACE_VERSION		1
+#define EVENT_TRACE_MAX_DEVICES		4
+#define EVENT_TRACE_MAX_KEYS		16
+#define EVENT_TRACE_MAX_ABS		4
+
+struct event_trace_abs {
+	uint32_t code;
+	struct input_absinfo info;
+};
+
+struct event_trace_device {
+	char name[64];
+	char path[64];
+	struct input_id id;
+	uint32_t nkeys;
+	uint32_t nabs;
+	uint16_t keys[EVENT_TRACE_MAX_KEYS];
+	struct event_trace_abs abs[EVENT_TRACE_MAX_ABS];
+};
+
+struct event_trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t ndevices;
+	uint64_t start_us;
+	struct event_trace_device devices[EVENT_TRACE_MAX_DEVICES];
+};
+
+struct event_trace_record {
+	uint64_t time_us;
+	uint8_t device;
+	uint8_t type;
+	uint16_t code;
+	int32_t value;
+};
+
+struct libevdev;
+
+struct event_trace_writer {
+	FILE *file;
+	uint64_t start_us;
+	unsigned long nrecords;
+};
+
+struct event_trace {
+	void *map;
+	size_t size;
+	const struct event_trace_header *header;
+	const struct event_trace_record *records;
+	size_t nrecords;
+};
+
+int event_trace_writer_open(struct event_trace_writer *writer, const char *path,
+			    struct libevdev **evdevs, const char **paths,
+			    unsigned int ndevices);
+int event_trace_write(struct event_trace_writer *writer, unsigned int device,
+		      const struct input_event *events, unsigned int nevents);
+int event_trace_writer_flush(struct event_trace_writer *writer);
+void event_trace_writer_close(struct event_trace_writer *writer);
+
+int event_trace_open(struct event_trace *trace, const char *path);
+void event_trace_close(struct event_trace *trace);
+
+int event_trace_create_devices(const struct event_trace *trace,
+			       struct uinput_device *devs);
+void event_trace_destroy_devices(const struct event_trace *trace,
+				 struct uinput_device *devs);
+int event_trace_replay(const struct event_trace *trace,
+		       struct uinput_device *devs, double speed);
+
+#endif /* _EVENT_TRACE_H */
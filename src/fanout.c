@@ -0,0 +1,319 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "event_loop.h"
+#include "fanout.h"
+
+#define FANOUT_QUEUE_MASK	(FANOUT_QUEUE_RECORDS - 1)
+
+static void fanout_client_remove(struct fanout_client *client)
+{
+	struct fanout_server *server = client->server;
+	unsigned int i;
+
+	for (i = 0; i < FANOUT_MAX_CLIENTS; i++)
+		if (server->clients[i] == client)
+			server->clients[i] = NULL;
+
+	server->dropped += client->dropped;
+	event_loop_remove(server->loop, client->source);
+	close(client->fd);
+	free(client);
+}
+
+/* Clients have nothing to say, only their hang up matters. */
+static int fanout_client_handler(int fd, uint32_t events, void *arg)
+{
+	char buf[64];
+	ssize_t len;
+
+	do {
+		len = read(fd, buf, sizeof(buf));
+	} while (len > 0);
+
+	if (len < 0 && errno == EAGAIN)
+		return 0;
+
+	fanout_client_remove(arg);
+	return 0;
+}
+
+static void fanout_accept(struct fanout_server *server, int fd)
+{
+	struct fanout_client *client;
+	unsigned int i;
+
+	for (i = 0; i < FANOUT_MAX_CLIENTS && server->clients[i]; i++)
+		;
+	if (i == FANOUT_MAX_CLIENTS) {
+		fprintf(stderr, "%s: too many clients\n", server->path);
+		close(fd);
+		return;
+	}
+
+	client = calloc(1, sizeof(*client));
+	if (!client) {
+		fprintf(stderr, "Can't allocate client\n");
+		close(fd);
+		return;
+	}
+	client->fd = fd;
+	client->server = server;
+
+	/* The socket buffer is empty, the header fits. */
+	if (send(fd, &server->header, sizeof(server->header), MSG_NOSIGNAL) !=
+	    sizeof(server->header)) {
+		close(fd);
+		free(client);
+		return;
+	}
+
+	client->source = event_loop_add_fd(server->loop, fd, 0, 0,
+					   fanout_client_handler, client);
+	if (!client->source) {
+		close(fd);
+		free(client);
+		return;
+	}
+
+	server->clients[i] = client;
+	server->clients_served++;
+}
+
+static int fanout_accept_handler(int fd, uint32_t events, void *arg)
+{
+	int client;
+
+	for (;;) {
+		client = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (client < 0)
+			break;
+		fanout_accept(arg, client);
+	}
+
+	if (errno != EAGAIN)
+		fprintf(stderr, "accept: %s\n", strerror(errno));
+
+	return 0;
+}
+
+struct fanout_server *fanout_start(struct event_loop *loop, const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct fanout_server *server;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "%s: socket path too long\n", path);
+		return NULL;
+	}
+
+	server = calloc(1, sizeof(*server));
+	if (!server) {
+		fprintf(stderr, "Can't allocate fan-out server\n");
+		return NULL;
+	}
+
+	memcpy(server->header.magic, FANOUT_MAGIC, sizeof(server->header.magic));
+	server->header.version = FANOUT_VERSION;
+	server->loop = loop;
+	strcpy(server->path, path);
+	strcpy(addr.sun_path, path);
+
+	server->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (server->fd < 0) {
+		fprintf(stderr, "Can't create socket: %s\n", strerror(errno));
+		free(server);
+		return NULL;
+	}
+
+	/* Left over by a previous run. */
+	unlink(path);
+
+	if (bind(server->fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(server->fd, FANOUT_MAX_CLIENTS)) {
+		fprintf(stderr, "Can't listen on %s: %s\n", path, strerror(errno));
+		goto out;
+	}
+
+	server->source = event_loop_add_fd(loop, server->fd, 0, 0,
+					   fanout_accept_handler, server);
+	if (!server->source)
+		goto out;
+
+	return server;
+
+out:
+	close(server->fd);
+	unlink(path);
+	free(server);
+	return NULL;
+}
+
+int fanout_add_device(struct fanout_server *server, const char *name,
+		      const char *type)
+{
+	struct fanout_header *header = &server->header;
+	unsigned int n = header->ndevices;
+
+	if (n == FANOUT_MAX_DEVICES) {
+		fprintf(stderr, "%s: %s not streamed, at most %d devices\n",
+			server->path, name, FANOUT_MAX_DEVICES);
+		return -1;
+	}
+
+	snprintf(header->devices[n].name, sizeof(header->devices[n].name), "%s", name);
+	snprintf(header->devices[n].type, sizeof(header->devices[n].type), "%s", type);
+	header->ndevices++;
+
+	return n;
+}
+
+void fanout_queue(struct fanout_server *server,
+		  const struct fanout_record *record)
+{
+	struct fanout_client *client;
+	unsigned int i;
+
+	server->records++;
+
+	for (i = 0; i < FANOUT_MAX_CLIENTS; i++) {
+		client = server->clients[i];
+		if (!client)
+			continue;
+
+		if (client->head - client->tail == FANOUT_QUEUE_RECORDS) {
+			client->tail++;
+			client->dropped++;
+		}
+		client->queue[client->head++ & FANOUT_QUEUE_MASK] = *record;
+	}
+}
+
+/*
+ * Send what the socket takes of the queue, in one call. Returns 1 if
+ * records are left, 0 if all were sent and -1 if the client is gone.
+ */
+static int fanout_client_flush(struct fanout_client *client)
+{
+	const size_t size = sizeof(struct fanout_record);
+	unsigned int count, first, run, rest;
+	struct msghdr msg = { 0 };
+	struct iovec iov[3];
+	ssize_t len;
+
+	if (client->partial_len) {
+		iov[msg.msg_iovlen].iov_base = client->partial;
+		iov[msg.msg_iovlen++].iov_len = client->partial_len;
+	}
+
+	count = client->head - client->tail;
+	if (count) {
+		first = client->tail & FANOUT_QUEUE_MASK;
+		run = count < FANOUT_QUEUE_RECORDS - first ?
+		      count : FANOUT_QUEUE_RECORDS - first;
+		iov[msg.msg_iovlen].iov_base = &client->queue[first];
+		iov[msg.msg_iovlen++].iov_len = run * size;
+		if (count > run) {
+			iov[msg.msg_iovlen].iov_base = client->queue;
+			iov[msg.msg_iovlen++].iov_len = (count - run) * size;
+		}
+	}
+
+	if (!msg.msg_iovlen)
+		return 0;
+
+	msg.msg_iov = iov;
+	len = sendmsg(client->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+	if (len < 0)
+		return errno == EAGAIN ? 1 : -1;
+
+	if (client->partial_len) {
+		if ((size_t)len < client->partial_len) {
+			client->partial_len -= len;
+			memmove(client->partial, client->partial + len,
+				client->partial_len);
+			return 1;
+		}
+		len -= client->partial_len;
+		client->partial_len = 0;
+	}
+
+	client->tail += len / size;
+	client->sent += len / size;
+
+	/* Keep the rest of a record cut short aside, its slot may be reused. */
+	rest = len % size;
+	if (rest) {
+		client->partial_len = size - rest;
+		memcpy(client->partial,
+		       (unsigned char *)&client->queue[client->tail & FANOUT_QUEUE_MASK] + rest,
+		       client->partial_len);
+		client->tail++;
+		client->sent++;
+	}
+
+	return client->head != client->tail || client->partial_len;
+}
+
+static int fanout_retry_handler(void *arg)
+{
+	fanout_flush(arg);
+	return 0;
+}
+
+/*
+ * To be called once the records of a loop pass are queued. The clients
+ * whose socket is full are retried every FANOUT_RETRY_MS meanwhile.
+ */
+void fanout_flush(struct fanout_server *server)
+{
+	bool pending = false;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < FANOUT_MAX_CLIENTS; i++) {
+		if (!server->clients[i])
+			continue;
+
+		ret = fanout_client_flush(server->clients[i]);
+		if (ret < 0)
+			fanout_client_remove(server->clients[i]);
+		else if (ret)
+			pending = true;
+	}
+
+	if (pending && !server->retry) {
+		server->retry = event_loop_add_timer(server->loop, FANOUT_RETRY_MS,
+						     -1, fanout_retry_handler, server);
+	} else if (!pending && server->retry) {
+		event_loop_remove(server->loop, server->retry);
+		server->retry = NULL;
+	}
+}
+
+void fanout_stop(struct fanout_server *server)
+{
+	unsigned int i;
+
+	if (!server)
+		return;
+
+	for (i = 0; i < FANOUT_MAX_CLIENTS; i++)
+		if (server->clients[i])
+			fanout_client_remove(server->clients[i]);
+
+	if (server->retry)
+		event_loop_remove(server->loop, server->retry);
+	event_loop_remove(server->loop, server->source);
+	close(server->fd);
+	unlink(server->path);
+	free(server);
+}
@@ -0,0 +1,82 @@
+#ifndef _FANOUT_H
+#define _FANOUT_H
+
+#include <stdint.h>
+
+/*
+ * Stream of device states to any number of Unix socket clients.
+ *
+ * A client first receives a struct fanout_header naming the devices, then
+ * one 24 byte struct fanout_record per state change, native endianness.
+ * Records are queued per client, and each flush sends all of a client's
+ * queue with one sendmsg(). A client too slow to keep up has its oldest
+ * records dropped, it is never waited for: it only loses intermediate
+ * states.
+ */
+#define FANOUT_MAGIC		"PTCSTATE"
+#define FANOUT_VERSION		1
+#define FANOUT_MAX_DEVICES	8
+#define FANOUT_MAX_CLIENTS	16
+/* Power of two. */
+#define FANOUT_QUEUE_RECORDS	256
+/* Retry period for the clients which couldn't take all their records. */
+#define FANOUT_RETRY_MS		20
+
+struct fanout_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t ndevices;
+	struct {
+		char name[32];
+		char type[16];
+	} devices[FANOUT_MAX_DEVICES];
+};
+
+struct fanout_record {
+	uint64_t time_us;
+	uint32_t device;
+	/* Buttons: bit i for the i-th key code. Scrollers: bit 0, touched. */
+	uint32_t keys;
+	int32_t position[2];
+};
+
+struct event_loop;
+struct event_source;
+struct fanout_server;
+
+struct fanout_client {
+	int fd;
+	struct fanout_server *server;
+	struct event_source *source;
+	unsigned int head;
+	unsigned int tail;
+	struct fanout_record queue[FANOUT_QUEUE_RECORDS];
+	/* Rest of a record the socket only took part of. */
+	unsigned char partial[sizeof(struct fanout_record)];
+	unsigned int partial_len;
+	unsigned long sent;
+	unsigned long dropped;
+};
+
+struct fanout_server {
+	int fd;
+	char path[108];
+	struct event_loop *loop;
+	struct event_source *source;
+	struct event_source *retry;
+	struct fanout_header header;
+	struct fanout_client *clients[FANOUT_MAX_CLIENTS];
+	unsigned long records;
+	unsigned long dropped;
+	unsigned long clients_served;
+};
+
+struct fanout_server *fanout_start(struct event_loop *loop, const char *path);
+int fanout_add_device(struct fanout_server *server, const char *name,
+		      const char *type);
+void fanout_queue(struct fanout_server *server,
+		  const struct fanout_record *record);
+void fanout_flush(struct fanout_server *server);
+void fanout_stop(struct fanout_server *server);
+
+#endif /* _FANOUT_H */
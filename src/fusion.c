@@ -0,0 +1,170 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "event_loop.h"
+#include "fusion.h"
+#include "latency.h"
+
+static int fusion_output(struct fusion *fusion)
+{
+	struct itimerspec its = { 0 };
+
+	/* Nothing left to wait for: the timer would only wake the loop up. */
+	if (fusion->timer_fd >= 0 &&
+	    timerfd_settime(fusion->timer_fd, 0, &its, NULL)) {
+		fprintf(stderr, "Can't disarm fusion timer: %s\n", strerror(errno));
+		return -1;
+	}
+
+	fusion->pending[0] = false;
+	fusion->pending[1] = false;
+	fusion->sample.touched = fusion->touched[0] && fusion->touched[1];
+	fusion->samples++;
+
+	return fusion->output(&fusion->sample, fusion->arg);
+}
+
+/*
+ * Wait for the other axis until window_us after the frame event. A frame
+ * read later than that still gets a minimal wait: the frame of the other
+ * axis is then most likely ready too and dispatched first.
+ */
+static int fusion_arm(struct fusion *fusion, unsigned long long time_us)
+{
+	struct itimerspec its = { 0 };
+	unsigned long long now_us = latency_now_us();
+	unsigned long long wait_us = fusion->window_us;
+
+	if (now_us > time_us)
+		wait_us = now_us - time_us < wait_us ? wait_us - (now_us - time_us) : 1;
+
+	its.it_value.tv_sec = wait_us / 1000000;
+	its.it_value.tv_nsec = wait_us % 1000000 * 1000;
+
+	if (timerfd_settime(fusion->timer_fd, 0, &its, NULL)) {
+		fprintf(stderr, "Can't arm fusion timer: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int fusion_timer_handler(int fd, uint32_t events, void *arg)
+{
+	struct fusion *fusion = arg;
+	uint64_t expirations;
+
+	/* Nothing to read: rearmed since it expired. */
+	if (read(fd, &expirations, sizeof(expirations)) < 0)
+		return errno == EAGAIN ? 0 : -1;
+
+	if (!fusion->pending[0] && !fusion->pending[1])
+		return 0;
+
+	return fusion_output(fusion);
+}
+
+struct fusion *fusion_new(struct event_loop *loop, unsigned int window_us,
+	int (*output)(const struct fusion_sample *sample, void *arg), void *arg)
+{
+	struct fusion *fusion;
+
+	fusion = calloc(1, sizeof(*fusion));
+	if (!fusion) {
+		fprintf(stderr, "Can't allocate fusion\n");
+		return NULL;
+	}
+
+	fusion->loop = loop;
+	fusion->window_us = window_us;
+	fusion->output = output;
+	fusion->arg = arg;
+	fusion->timer_fd = -1;
+
+	if (!window_us)
+		return fusion;
+
+	fusion->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fusion->timer_fd < 0) {
+		fprintf(stderr, "Can't create fusion timer: %s\n", strerror(errno));
+		free(fusion);
+		return NULL;
+	}
+
+	fusion->source = event_loop_add_fd(loop, fusion->timer_fd, 0, 0,
+					   fusion_timer_handler, fusion);
+	if (!fusion->source) {
+		close(fusion->timer_fd);
+		free(fusion);
+		return NULL;
+	}
+
+	return fusion;
+}
+
+void fusion_free(struct fusion *fusion)
+{
+	if (!fusion)
+		return;
+
+	event_loop_remove(fusion->loop, fusion->source);
+	if (fusion->timer_fd >= 0)
+		close(fusion->timer_fd);
+	free(fusion);
+}
+
+/*
+ * New frame of an axis, 0 for X and 1 for Y. The output callback is called
+ * from here or from the fusion timer, its error is returned.
+ */
+int fusion_update(struct fusion *fusion, unsigned int axis,
+		  const struct timeval *time, bool touched,
+		  unsigned int position)
+{
+	unsigned long long time_us = latency_timeval_us(time);
+	unsigned int other = !axis;
+	unsigned long long delta;
+	int ret;
+
+	fusion->frames++;
+
+	/* Another report started: the frames waiting are output on their own. */
+	if (fusion->pending[other]) {
+		delta = time_us > fusion->time_us[other] ?
+			time_us - fusion->time_us[other] :
+			fusion->time_us[other] - time_us;
+		if (delta > fusion->window_us) {
+			ret = fusion_output(fusion);
+			if (ret)
+				return ret;
+		}
+	}
+	if (fusion->pending[axis]) {
+		ret = fusion_output(fusion);
+		if (ret)
+			return ret;
+	}
+
+	if (!fusion->pending[other] || timercmp(time, &fusion->sample.time, >))
+		fusion->sample.time = *time;
+	fusion->sample.position[axis] = position;
+	fusion->touched[axis] = touched;
+
+	if (fusion->pending[other]) {
+		fusion->paired++;
+		return fusion_output(fusion);
+	}
+
+	if (!fusion->window_us)
+		return fusion_output(fusion);
+
+	fusion->pending[axis] = true;
+	fusion->time_us[axis] = time_us;
+
+	return fusion_arm(fusion, time_us);
+}
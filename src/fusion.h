@@ -0,0 +1,55 @@
+#ifndef _FUSION_H
+#define _FUSION_H
+
+#include <stdbool.h>
+#include <sys/time.h>
+
+/*
+ * X/Y fusion of the two inputs of a 2D surface: the X and Y frames of one
+ * report of the PTC are paired by their event timestamps, within window_us
+ * of each other, and output as one sample. A frame whose pair doesn't come
+ * within the window is output alone, once the window is over. A window of
+ * 0 outputs every frame at once, with the latest position of the other axis.
+ */
+#define FUSION_DEFAULT_WINDOW_US	2000
+#define FUSION_USAGE \
+	"  -w us       output X and Y together when their frames are this close\n" \
+	"              (default 2000, 0 to output every frame)\n"
+
+struct event_loop;
+struct event_source;
+
+struct fusion_sample {
+	/* Event time of the latest frame of the sample. */
+	struct timeval time;
+	/* 0 on an axis not touched. */
+	unsigned int position[2];
+	/* Both axes touched. */
+	bool touched;
+};
+
+struct fusion {
+	unsigned int window_us;
+	int (*output)(const struct fusion_sample *sample, void *arg);
+	void *arg;
+	struct fusion_sample sample;
+	bool touched[2];
+	/* Frame of each axis waiting for the other one. */
+	bool pending[2];
+	unsigned long long time_us[2];
+	struct event_loop *loop;
+	int timer_fd;
+	struct event_source *source;
+	unsigned long frames;
+	unsigned long samples;
+	unsigned long paired;
+};
+
+struct fusion *fusion_new(struct event_loop *loop, unsigned int window_us,
+	int (*output)(const struct fusion_sample *sample, void *arg), void *arg);
+void fusion_free(struct fusion *fusion);
+int fusion_update(struct fusion *fusion, unsigned int axis,
+		  const struct timeval *time, bool touched,
+		  unsigned int position);
+
+#endif /* _FUSION_H */
@@ -1,15 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <gpiod.h>
 
 #include "gpio_helper.h"
 
 static struct gpiod_chip *gpiochip = NULL;
 
-int gpio_init()
+int gpio_init_chip(const char *path)
 {
 	if (!gpiochip) {
-		gpiochip = gpiod_chip_open("/dev/gpiochip0");
+		gpiochip = gpiod_chip_open(path);
 		if (!gpiochip) {
 			fprintf(stderr, "gpiod_chip_open failed\n");
 			return -1;
@@ -19,26 +20,34 @@ int gpio_init()
 	return 0;
 }
 
+/*
+ * PTC_GPIOCHIP selects another chip than the SoC one, e.g. a gpio-sim or
+ * gpio-mockup chip to run the demos without the wing.
+ */
+int gpio_init()
+{
+	const char *path = getenv("PTC_GPIOCHIP");
+
+	return gpio_init_chip(path ? path : "/dev/gpiochip0");
+}
+
 void gpio_fini()
 {
 	if (gpiochip)
 		gpiod_chip_close(gpiochip);
 }
 
-int gpio_led_request(struct gpio_led_desc *led)
+static struct gpiod_line_request *gpio_request_output_lines(const unsigned int *offsets,
+							      unsigned int nlines)
 {
-	struct gpiod_request_config *req_cfg;
 	struct gpiod_line_request *request = NULL;
+	struct gpiod_request_config *req_cfg;
 	struct gpiod_line_settings *settings;
 	struct gpiod_line_config *line_cfg;
-	int ret = -1;
-
-	if (!led)
-		return ret;
 
 	settings = gpiod_line_settings_new();
 	if (!settings)
-		return ret;
+		return NULL;
 
 	if (gpiod_line_settings_set_direction(settings, GPIOD_LINE_DIRECTION_OUTPUT))
 		goto free_settings;
@@ -52,7 +61,7 @@ int gpio_led_request(struct gpio_led_desc *led)
 	if (!line_cfg)
 		goto free_settings;
 
-	if (gpiod_line_config_add_line_settings(line_cfg, &led->pin_id, 1, settings))
+	if (gpiod_line_config_add_line_settings(line_cfg, offsets, nlines, settings))
 		goto free_line_config;
 
 	req_cfg = gpiod_request_config_new();
@@ -61,9 +70,7 @@ int gpio_led_request(struct gpio_led_desc *led)
 
 	gpiod_request_config_set_consumer(req_cfg, "ptc qt example");
 
-	led->gpio_line = gpiod_chip_request_lines(gpiochip, req_cfg, line_cfg);
-	if (led->gpio_line)
-		ret = 0;
+	request = gpiod_chip_request_lines(gpiochip, req_cfg, line_cfg);
 
 	gpiod_request_config_free(req_cfg);
 
@@ -73,7 +80,17 @@ free_line_config:
 free_settings:
 	gpiod_line_settings_free(settings);
 
-	return ret;
+	return request;
+}
+
+int gpio_led_request(struct gpio_led_desc *led)
+{
+	if (!led)
+		return -1;
+
+	led->gpio_line = gpio_request_output_lines(&led->pin_id, 1);
+
+	return led->gpio_line ? 0 : -1;
 }
 
 void gpio_led_release(struct gpio_led_desc *led)
@@ -98,3 +115,102 @@ int gpio_led_off(struct gpio_led_desc *led)
 	return gpiod_line_request_set_value(led->gpio_line, led->pin_id, GPIOD_LINE_VALUE_INACTIVE);
 }
 
+
+int gpio_led_bank_request(struct gpio_led_bank *bank,
+			  const struct gpio_led_desc *leds, unsigned int nleds)
+{
+	unsigned int i;
+
+	if (!bank || nleds > GPIO_LED_BANK_MAX_LEDS)
+		return -1;
+
+	bank->request = NULL;
+	bank->nleds = nleds;
+	bank->values = 0;
+	bank->writes = 0;
+	bank->skipped = 0;
+	bank->errors = 0;
+	memset(&bank->write_latency, 0, sizeof(bank->write_latency));
+
+	/* Nothing to request for input devices without LEDs. */
+	if (!nleds)
+		return 0;
+
+	for (i = 0; i < nleds; i++)
+		bank->offsets[i] = leds[i].pin_id;
+
+	bank->request = gpio_request_output_lines(bank->offsets, nleds);
+
+	return bank->request ? 0 : -1;
+}
+
+void gpio_led_bank_release(struct gpio_led_bank *bank)
+{
+	if (bank && bank->request) {
+		gpiod_line_request_release(bank->request);
+		bank->request = NULL;
+	}
+}
+
+static unsigned int gpio_led_bank_mask(const struct gpio_led_bank *bank)
+{
+	return bank->nleds < 32 ? (1u << bank->nleds) - 1 : ~0u;
+}
+
+/*
+ * Set the LEDs selected by mask to the state given by the same bits of
+ * values, leaving the other LEDs of the bank untouched. The lines which
+ * actually change are written with a single ioctl, none if the LEDs are
+ * already in the requested state.
+ */
+int gpio_led_bank_update(struct gpio_led_bank *bank, unsigned int mask,
+			 unsigned int values)
+{
+	enum gpiod_line_value line_values[GPIO_LED_BANK_MAX_LEDS];
+	unsigned int offsets[GPIO_LED_BANK_MAX_LEDS];
+	unsigned int i, changed, n = 0;
+	unsigned long long start;
+	int ret;
+
+	if (!bank || !bank->request)
+		return -1;
+
+	mask &= gpio_led_bank_mask(bank);
+	changed = mask & (values ^ bank->values);
+	counter_add(&bank->skipped, __builtin_popcount(mask & ~changed));
+
+	if (!changed)
+		return 0;
+
+	for (i = 0; i < bank->nleds; i++) {
+		if (!(changed & (1u << i)))
+			continue;
+
+		offsets[n] = bank->offsets[i];
+		line_values[n] = (values & (1u << i)) ?
+			GPIOD_LINE_VALUE_ACTIVE : GPIOD_LINE_VALUE_INACTIVE;
+		n++;
+	}
+
+	start = latency_now_us();
+	ret = gpiod_line_request_set_values_subset(bank->request, n,
+						   offsets, line_values);
+	if (ret) {
+		counter_inc(&bank->errors);
+		return ret;
+	}
+	latency_hist_add(&bank->write_latency, latency_now_us() - start);
+
+	bank->values = (bank->values & ~changed) | (values & changed);
+	counter_inc(&bank->writes);
+
+	return 0;
+}
+
+int gpio_led_bank_set(struct gpio_led_bank *bank, unsigned int values)
+{
+	if (!bank)
+		return -1;
+
+	return gpio_led_bank_update(bank, ~0u, values);
+}
@@ -1,4 +1,10 @@
 #ifndef _GPIO_HELPER_H
+#define _GPIO_HELPER_H
+
+#include "counter.h"
+#include "latency.h"
+
+#define GPIO_LED_BANK_MAX_LEDS	32
 
 struct gpiod_line_request;
 
@@ -8,12 +14,42 @@ struct gpio_led_desc {
 	struct gpiod_line_request *gpio_line;
 };
 
+/*
+ * All the LEDs of a scroller or of a button group requested at once: a
+ * single line request (and file descriptor) for the whole bank and a single
+ * ioctl to update any subset of its LEDs. LED i of the bank is bit i of the
+ * masks used by the bank API.
+ *
+ * The bank remembers the last values written to its lines and only sends
+ * the lines that change, so that rewriting the same LED pattern costs no
+ * syscall. skipped counts the line writes avoided that way and
+ * write_latency records the duration of the ioctls actually issued, errors
+ * the ioctls which failed.
+ */
+struct gpio_led_bank {
+	struct gpiod_line_request *request;
+	unsigned int nleds;
+	unsigned int offsets[GPIO_LED_BANK_MAX_LEDS];
+	unsigned int values;
+	atomic_ulong writes;
+	atomic_ulong skipped;
+	atomic_ulong errors;
+	struct latency_hist write_latency;
+};
 
 int gpio_init();
+int gpio_init_chip(const char *path);
 void gpio_fini();
 int gpio_led_request(struct gpio_led_desc *led);
 void gpio_led_release(struct gpio_led_desc *led);
 int gpio_led_on(struct gpio_led_desc *led);
 int gpio_led_off(struct gpio_led_desc *led);
 
+int gpio_led_bank_request(struct gpio_led_bank *bank,
+			  const struct gpio_led_desc *leds, unsigned int nleds);
+void gpio_led_bank_release(struct gpio_led_bank *bank);
+int gpio_led_bank_update(struct gpio_led_bank *bank, unsigned int mask,
+			 unsigned int values);
+int gpio_led_bank_set(struct gpio_led_bank *bank, unsigned int values);
+
 #endif /* _GPIO_HELPER_H */
@@ -0,0 +1,283 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "event_loop.h"
+#include "hotplug.h"
+#include "ptc_qt.h"
+
+#define HOTPLUG_EVENTS	(IN_CREATE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM)
+
+static int hotplug_device_fd(const struct hotplug_device *dev)
+{
+	return dev->scroller ? dev->scroller->fd : dev->buttons->fd;
+}
+
+static void hotplug_detach(struct hotplug_device *dev)
+{
+	if (!dev->attached)
+		return;
+
+	event_loop_remove(dev->hotplug->loop, dev->source);
+	dev->source = NULL;
+
+	if (dev->scroller)
+		scroller_detach(dev->scroller);
+	else
+		buttons_detach(dev->buttons);
+
+	dev->attached = false;
+	dev->lost_us = latency_now_us();
+	fprintf(stderr, "%s: device removed, waiting for it\n", dev->path);
+}
+
+static int hotplug_device_handler(int fd, uint32_t events, void *arg)
+{
+	struct hotplug_device *dev = arg;
+	int ret;
+
+	ret = dev->handler(fd, events, dev->arg);
+	if (ret == -ENODEV) {
+		hotplug_detach(dev);
+		return 0;
+	}
+
+	return ret;
+}
+
+static int hotplug_register(struct hotplug_device *dev)
+{
+	dev->source = event_loop_add_fd(dev->hotplug->loop, hotplug_device_fd(dev),
+					0, 0, hotplug_device_handler, dev);
+	if (!dev->source)
+		return -1;
+
+	dev->attached = true;
+	return 0;
+}
+
+static int hotplug_attach(struct hotplug_device *dev)
+{
+	unsigned long long start_us = latency_now_us(), done_us;
+	int ret;
+
+	if (dev->scroller)
+		ret = scroller_attach(dev->scroller, dev->path);
+	else
+		ret = buttons_attach(dev->buttons, dev->path);
+	if (ret)
+		return -1;
+
+	if (hotplug_register(dev)) {
+		if (dev->scroller)
+			scroller_detach(dev->scroller);
+		else
+			buttons_detach(dev->buttons);
+		return -1;
+	}
+
+	done_us = latency_now_us();
+	latency_hist_add(&dev->reattach_latency, done_us - dev->lost_us);
+	dev->reattached++;
+	dev->retries = 0;
+	fprintf(stderr, "%s: reattached %llu ms after its removal, in %llu us\n",
+		dev->path, (done_us - dev->lost_us) / 1000, done_us - start_us);
+
+	return 0;
+}
+
+static int hotplug_retry_handler(void *arg)
+{
+	struct hotplug *hotplug = arg;
+	bool pending = false;
+	unsigned int i;
+
+	for (i = 0; i < hotplug->ndevices; i++) {
+		struct hotplug_device *dev = &hotplug->devices[i];
+
+		if (dev->attached || !dev->retries)
+			continue;
+
+		dev->retries--;
+		if (hotplug_attach(dev) && dev->retries)
+			pending = true;
+	}
+
+	if (!pending) {
+		event_loop_remove(hotplug->loop, hotplug->retry);
+		hotplug->retry = NULL;
+	}
+
+	return 0;
+}
+
+static void hotplug_appeared(struct hotplug *hotplug, struct hotplug_device *dev)
+{
+	if (dev->attached || !hotplug_attach(dev))
+		return;
+
+	dev->retries = HOTPLUG_RETRIES;
+	if (!hotplug->retry)
+		hotplug->retry = event_loop_add_timer(hotplug->loop, HOTPLUG_RETRY_MS,
+						      0, hotplug_retry_handler, hotplug);
+}
+
+static int hotplug_handler(int fd, uint32_t events, void *arg)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	struct hotplug *hotplug = arg;
+	struct hotplug_device *dev;
+	unsigned int i;
+	ssize_t len;
+	char *p;
+
+	for (;;) {
+		len = read(fd, buf, sizeof(buf));
+		if (len < 0)
+			return errno == EAGAIN ? 0 : -1;
+
+		for (p = buf; p < buf + len; p += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *)p;
+
+			for (i = 0; i < hotplug->ndevices; i++) {
+				dev = &hotplug->devices[i];
+
+				/* Events were lost, check every device. */
+				if (ev->mask & IN_Q_OVERFLOW) {
+					if (!access(dev->path, F_OK))
+						hotplug_appeared(hotplug, dev);
+					continue;
+				}
+
+				if (ev->wd != dev->wd || !ev->len ||
+				    strcmp(ev->name, dev->name))
+					continue;
+
+				if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+					hotplug_detach(dev);
+				else
+					hotplug_appeared(hotplug, dev);
+			}
+		}
+	}
+}
+
+struct hotplug *hotplug_new(struct event_loop *loop)
+{
+	struct hotplug *hotplug;
+
+	hotplug = calloc(1, sizeof(*hotplug));
+	if (!hotplug) {
+		fprintf(stderr, "Can't allocate hotplug\n");
+		return NULL;
+	}
+	hotplug->loop = loop;
+
+	hotplug->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (hotplug->fd < 0) {
+		fprintf(stderr, "Can't init inotify: %s\n", strerror(errno));
+		free(hotplug);
+		return NULL;
+	}
+
+	hotplug->source = event_loop_add_fd(loop, hotplug->fd, 0, 0,
+					    hotplug_handler, hotplug);
+	if (!hotplug->source) {
+		close(hotplug->fd);
+		free(hotplug);
+		return NULL;
+	}
+
+	return hotplug;
+}
+
+/* The devices themselves are left to their owner. */
+void hotplug_free(struct hotplug *hotplug)
+{
+	unsigned int i;
+
+	if (!hotplug)
+		return;
+
+	for (i = 0; i < hotplug->ndevices; i++)
+		event_loop_remove(hotplug->loop, hotplug->devices[i].source);
+	event_loop_remove(hotplug->loop, hotplug->retry);
+	event_loop_remove(hotplug->loop, hotplug->source);
+	close(hotplug->fd);
+	free(hotplug);
+}
+
+static int hotplug_add(struct hotplug *hotplug, struct scroller *scroller,
+	struct buttons *buttons, const char *input_file,
+	int (*handler)(int fd, uint32_t events, void *arg), void *arg)
+{
+	struct hotplug_device *dev;
+	char dir[sizeof(dev->path)];
+	char *slash;
+
+	if (hotplug->ndevices == HOTPLUG_MAX_DEVICES ||
+	    strlen(input_file) >= sizeof(dev->path)) {
+		fprintf(stderr, "%s: can't be watched\n", input_file);
+		return -1;
+	}
+
+	dev = &hotplug->devices[hotplug->ndevices];
+	memset(dev, 0, sizeof(*dev));
+	dev->hotplug = hotplug;
+	dev->scroller = scroller;
+	dev->buttons = buttons;
+	dev->handler = handler;
+	dev->arg = arg;
+	strcpy(dev->path, input_file);
+
+	strcpy(dir, input_file);
+	slash = strrchr(dir, '/');
+	if (slash == dir)
+		slash[1] = '\0';
+	else if (slash)
+		*slash = '\0';
+	else
+		strcpy(dir, ".");
+	dev->name = slash ? dev->path + (slash - dir) + 1 : dev->path;
+
+	/* Same watch, and wd, for the devices of a directory. */
+	dev->wd = inotify_add_watch(hotplug->fd, dir, HOTPLUG_EVENTS);
+	if (dev->wd < 0) {
+		fprintf(stderr, "Can't watch %s: %s\n", dir, strerror(errno));
+		return -1;
+	}
+
+	if (hotplug_register(dev))
+		return -1;
+
+	hotplug->ndevices++;
+	return 0;
+}
+
+int hotplug_add_scroller(struct hotplug *hotplug, struct scroller *scroller,
+	const char *input_file,
+	int (*handler)(int fd, uint32_t events, void *arg), void *arg)
+{
+	return hotplug_add(hotplug, scroller, NULL, input_file, handler, arg);
+}
+
+int hotplug_add_buttons(struct hotplug *hotplug, struct buttons *buttons,
+	const char *input_file,
+	int (*handler)(int fd, uint32_t events, void *arg), void *arg)
+{
+	return hotplug_add(hotplug, NULL, buttons, input_file, handler, arg);
+}
+
+void hotplug_print_stats(const struct hotplug *hotplug, FILE *f)
+{
+	unsigned int i;
+
+	for (i = 0; i < hotplug->ndevices; i++)
+		if (hotplug->devices[i].reattached)
+			latency_hist_print(&hotplug->devices[i].reattach_latency, f,
+					   hotplug->devices[i].path, "reattach");
+}
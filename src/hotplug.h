@@ -0,0 +1,71 @@
+#ifndef _HOTPLUG_H
+#define _HOTPLUG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "latency.h"
+
+/*
+ * Keep the buttons and scrollers of a demo across driver reloads: the
+ * directories of their input files are watched with inotify, a device is
+ * detached when its file is removed or its reads fail with ENODEV, and
+ * attached again, with the same struct scroller or struct buttons, LEDs
+ * and settings, as soon as its file is back. The time from losing a
+ * device to having it back is recorded in reattach_latency.
+ */
+#define HOTPLUG_MAX_DEVICES	16
+/* The new node may not be usable yet when it appears. */
+#define HOTPLUG_RETRY_MS	50
+#define HOTPLUG_RETRIES		20
+
+struct buttons;
+struct scroller;
+struct event_loop;
+struct event_source;
+struct hotplug;
+
+struct hotplug_device {
+	struct hotplug *hotplug;
+	int wd;
+	char path[64];
+	const char *name;
+	struct scroller *scroller;
+	struct buttons *buttons;
+	int (*handler)(int fd, uint32_t events, void *arg);
+	void *arg;
+	struct event_source *source;
+	bool attached;
+	unsigned int retries;
+	unsigned long long lost_us;
+	unsigned long reattached;
+	struct latency_hist reattach_latency;
+};
+
+struct hotplug {
+	int fd;
+	struct event_loop *loop;
+	struct event_source *source;
+	struct event_source *retry;
+	unsigned int ndevices;
+	struct hotplug_device devices[HOTPLUG_MAX_DEVICES];
+};
+
+struct hotplug *hotplug_new(struct event_loop *loop);
+void hotplug_free(struct hotplug *hotplug);
+
+/*
+ * Register the fd of an initialized scroller or buttons on the loop, in
+ * place of event_loop_add_fd(). handler is called as for the fd source,
+ * -ENODEV returned by it detaches the device instead of stopping the loop.
+ */
+int hotplug_add_scroller(struct hotplug *hotplug, struct scroller *scroller,
+	const char *input_file,
+	int (*handler)(int fd, uint32_t events, void *arg), void *arg);
+int hotplug_add_buttons(struct hotplug *hotplug, struct buttons *buttons,
+	const char *input_file,
+	int (*handler)(int fd, uint32_t events, void *arg), void *arg);
+void hotplug_print_stats(const struct hotplug *hotplug, FILE *f);
+
+#endif /* _HOTPLUG_H */
@@ -0,0 +1,271 @@
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "event_loop.h"
+#include "is31fl3728.h"
+
+#define IS31FL3728_CONFIG_REG		0x0
+#define IS31FL3728_COLUMN_REG(c)	(0x1 + (c))
+#define IS31FL3728_UPDATE_COLUMN_REG	0xc
+
+static int is31fl3728_smbus_write(struct is31fl3728 *dev,
+				  unsigned char (*bufs)[2], unsigned int n)
+{
+	struct i2c_smbus_ioctl_data args;
+	union i2c_smbus_data data;
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		data.byte = bufs[i][1];
+		args.read_write = I2C_SMBUS_WRITE;
+		args.command = bufs[i][0];
+		args.size = I2C_SMBUS_BYTE_DATA;
+		args.data = &data;
+		if (ioctl(dev->fd, I2C_SMBUS, &args) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Register writes bringing the matrix to fb, returns their number. */
+static unsigned int is31fl3728_prepare(struct is31fl3728 *dev,
+				       bool force_config, bool force_columns,
+				       unsigned char (*bufs)[2])
+{
+	unsigned int c, n = 0;
+
+	if (force_config) {
+		bufs[n][0] = IS31FL3728_CONFIG_REG;
+		bufs[n][1] = 0x0;
+		n++;
+	}
+
+	for (c = 0; c < IS31FL3728_NB_COLUMNS; c++) {
+		if (!force_columns && dev->fb[c] == dev->shown[c])
+			continue;
+
+		bufs[n][0] = IS31FL3728_COLUMN_REG(c);
+		bufs[n][1] = dev->fb[c];
+		n++;
+	}
+
+	if (!n)
+		return 0;
+
+	/* Column data is latched by writing the update column register. */
+	bufs[n][0] = IS31FL3728_UPDATE_COLUMN_REG;
+	bufs[n][1] = 0x1;
+	n++;
+
+	return n;
+}
+
+static int is31fl3728_transfer(struct is31fl3728 *dev, bool force_config,
+			       bool force_columns)
+{
+	unsigned char bufs[IS31FL3728_MAX_MSGS][2];
+	struct i2c_msg msgs[IS31FL3728_MAX_MSGS];
+	struct i2c_rdwr_ioctl_data data;
+	unsigned int c, n;
+	unsigned long long start;
+
+	n = is31fl3728_prepare(dev, force_config, force_columns, bufs);
+	if (!n)
+		return 0;
+
+	for (c = 0; c < n; c++) {
+		msgs[c].addr = dev->addr;
+		msgs[c].flags = 0;
+		msgs[c].len = 2;
+		msgs[c].buf = bufs[c];
+	}
+
+	data.msgs = msgs;
+	data.nmsgs = n;
+	start = latency_now_us();
+	if (dev->smbus ? is31fl3728_smbus_write(dev, bufs, n) :
+			 ioctl(dev->fd, I2C_RDWR, &data) < 0) {
+		fprintf(stderr, "Failed to write to the i2c bus\n");
+		counter_inc(&dev->errors);
+		return -1;
+	}
+	latency_hist_add(&dev->write_latency, latency_now_us() - start);
+
+	memcpy(dev->shown, dev->fb, sizeof(dev->shown));
+	counter_inc(&dev->transfers);
+	counter_add(&dev->bytes, n * sizeof(bufs[0]));
+
+	return 0;
+}
+
+int is31fl3728_open(struct is31fl3728 *dev, const char *i2c_file,
+		    unsigned short addr)
+{
+	unsigned long funcs;
+
+	dev->addr = addr;
+	dev->smbus = false;
+	dev->transfers = 0;
+	dev->bytes = 0;
+	dev->errors = 0;
+	dev->loop = NULL;
+	dev->inflight = false;
+	dev->pending = false;
+	memset(&dev->write_latency, 0, sizeof(dev->write_latency));
+
+	dev->fd = open(i2c_file, O_RDWR);
+	if (dev->fd < 0) {
+		fprintf(stderr, "Can't open %s\n", i2c_file);
+		return -1;
+	}
+
+	if (ioctl(dev->fd, I2C_FUNCS, &funcs) < 0) {
+		fprintf(stderr, "Can't get %s functionalities\n", i2c_file);
+		goto out;
+	}
+
+	if (!(funcs & I2C_FUNC_I2C)) {
+		if (!(funcs & I2C_FUNC_SMBUS_WRITE_BYTE_DATA) ||
+		    ioctl(dev->fd, I2C_SLAVE, addr) < 0) {
+			fprintf(stderr, "Failed to acquire bus access and/or talk to slave\n");
+			goto out;
+		}
+		dev->smbus = true;
+	}
+
+	/* Start from a known state: normal operation, all LEDs off. */
+	is31fl3728_clear(dev);
+	if (is31fl3728_transfer(dev, true, true))
+		goto out;
+
+	return 0;
+
+out:
+	close(dev->fd);
+	dev->fd = -1;
+	return -1;
+}
+
+void is31fl3728_close(struct is31fl3728 *dev)
+{
+	if (dev->fd >= 0) {
+		close(dev->fd);
+		dev->fd = -1;
+	}
+	dev->loop = NULL;
+}
+
+void is31fl3728_clear(struct is31fl3728 *dev)
+{
+	memset(dev->fb, 0, sizeof(dev->fb));
+}
+
+void is31fl3728_set_column(struct is31fl3728 *dev, unsigned int column,
+			   unsigned char rows)
+{
+	if (column < IS31FL3728_NB_COLUMNS)
+		dev->fb[column] = rows;
+}
+
+static void is31fl3728_write_done(int res, void *arg)
+{
+	struct is31fl3728 *dev = arg;
+	unsigned int c;
+
+	dev->inflight = false;
+	if (res < 0) {
+		fprintf(stderr, "Failed to write to the i2c bus: %s\n", strerror(-res));
+		counter_inc(&dev->errors);
+		/* Unknown state: make every column differ to send them all. */
+		for (c = 0; c < IS31FL3728_NB_COLUMNS; c++)
+			dev->shown[c] = ~dev->fb[c];
+	} else {
+		latency_hist_add(&dev->write_latency,
+				 latency_now_us() - dev->queued_us);
+	}
+
+	if (dev->pending) {
+		dev->pending = false;
+		is31fl3728_flush(dev);
+	}
+}
+
+static int is31fl3728_queue(struct is31fl3728 *dev)
+{
+	unsigned int i, n;
+
+	if (dev->inflight) {
+		dev->pending = true;
+		return 0;
+	}
+
+	n = is31fl3728_prepare(dev, false, false, dev->queued);
+	if (!n)
+		return 0;
+
+	for (i = 0; i < n; i++) {
+		if (event_loop_write(dev->loop, dev->fd, dev->queued[i], 2,
+				     i < n - 1 ? EVENT_LOOP_WRITE_LINK : 0,
+				     i < n - 1 ? NULL : is31fl3728_write_done, dev)) {
+			fprintf(stderr, "Can't queue i2c writes\n");
+			counter_inc(&dev->errors);
+			return -1;
+		}
+	}
+
+	dev->inflight = true;
+	dev->queued_us = latency_now_us();
+	memcpy(dev->shown, dev->fb, sizeof(dev->shown));
+	counter_inc(&dev->transfers);
+	counter_add(&dev->bytes, n * sizeof(dev->queued[0]));
+
+	return 0;
+}
+
+int is31fl3728_flush(struct is31fl3728 *dev)
+{
+	if (dev->loop)
+		return is31fl3728_queue(dev);
+
+	return is31fl3728_transfer(dev, false, false);
+}
+
+/*
+ * Queue the register writes on an io_uring loop. Plain write()s are single
+ * message transfers to the address set with I2C_SLAVE, SMBus only adapters
+ * keep their synchronous transfers, as do epoll loops.
+ */
+void is31fl3728_set_loop(struct is31fl3728 *dev, struct event_loop *loop)
+{
+	if (!event_loop_is_uring(loop))
+		return;
+
+	if (dev->smbus) {
+		fprintf(stderr, "SMBus only adapter, LED matrix writes stay synchronous\n");
+		return;
+	}
+
+	if (ioctl(dev->fd, I2C_SLAVE, dev->addr) < 0) {
+		fprintf(stderr, "Can't address the LED matrix, writes stay synchronous\n");
+		return;
+	}
+
+	dev->loop = loop;
+}
+
+/* Same line format as scroller_print_counters(). */
+void is31fl3728_print_counters(const struct is31fl3728 *dev, FILE *f,
+			       const char *name)
+{
+	fprintf(f, "%s transfers=%lu bytes=%lu errors=%lu\n", name,
+		counter_read(&dev->transfers), counter_read(&dev->bytes),
+		counter_read(&dev->errors));
+}
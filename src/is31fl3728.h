@@ -0,0 +1,60 @@
+#ifndef _IS31FL3728_H
+#define _IS31FL3728_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "counter.h"
+#include "latency.h"
+
+#define IS31FL3728_NB_COLUMNS	8
+/* Configuration register, one message per column and the update column. */
+#define IS31FL3728_MAX_MSGS	(IS31FL3728_NB_COLUMNS + 2)
+
+struct event_loop;
+
+/*
+ * In-memory framebuffer for the IS31FL3728 LED matrix driver. Drawing only
+ * touches fb, is31fl3728_flush() then sends the columns which differ from
+ * the frame last sent, followed by the update column register, as a single
+ * I2C_RDWR transaction. Nothing is sent when the frame did not change.
+ * write_latency records the duration of these transactions, bytes the
+ * register data sent and errors the transactions which failed.
+ *
+ * On SMBus only adapters, such as i2c-stub, the registers are written one
+ * SMBus transfer at a time instead.
+ *
+ * Attached to an io_uring event loop with is31fl3728_set_loop(), the
+ * register writes are queued on the loop as linked write()s instead, sent
+ * along with the next wait. A frame drawn while the previous one is still
+ * being written is only sent once that completes.
+ */
+struct is31fl3728 {
+	int fd;
+	unsigned short addr;
+	bool smbus;
+	unsigned char fb[IS31FL3728_NB_COLUMNS];
+	unsigned char shown[IS31FL3728_NB_COLUMNS];
+	atomic_ulong transfers;
+	atomic_ulong bytes;
+	atomic_ulong errors;
+	struct latency_hist write_latency;
+	struct event_loop *loop;
+	unsigned char queued[IS31FL3728_MAX_MSGS][2];
+	unsigned long long queued_us;
+	bool inflight;
+	bool pending;
+};
+
+int is31fl3728_open(struct is31fl3728 *dev, const char *i2c_file,
+		    unsigned short addr);
+void is31fl3728_close(struct is31fl3728 *dev);
+void is31fl3728_clear(struct is31fl3728 *dev);
+void is31fl3728_set_column(struct is31fl3728 *dev, unsigned int column,
+			   unsigned char rows);
+int is31fl3728_flush(struct is31fl3728 *dev);
+void is31fl3728_set_loop(struct is31fl3728 *dev, struct event_loop *loop);
+void is31fl3728_print_counters(const struct is31fl3728 *dev, FILE *f,
+			       const char *name);
+
+#endif /* _IS31FL3728_H */
@@ -0,0 +1,68 @@
+#include "latency.h"
+
+static unsigned int latency_bucket(unsigned long long us)
+{
+	unsigned int msb, bucket;
+
+	if (us < 8)
+		return us;
+
+	msb = 63 - __builtin_clzll(us);
+	bucket = 8 + (msb - 3) * 4 + ((us >> (msb - 2)) & 0x3);
+
+	return bucket < LATENCY_HIST_BUCKETS ? bucket : LATENCY_HIST_BUCKETS - 1;
+}
+
+/* Highest latency falling into a bucket. */
+static unsigned long long latency_bucket_max(unsigned int bucket)
+{
+	unsigned int msb, sub;
+
+	if (bucket < 8)
+		return bucket;
+
+	msb = 3 + (bucket - 8) / 4;
+	sub = (bucket - 8) % 4;
+
+	return ((5ULL + sub) << (msb - 2)) - 1;
+}
+
+void latency_hist_add(struct latency_hist *hist, unsigned long long us)
+{
+	hist->buckets[latency_bucket(us)]++;
+	hist->count++;
+	if (us > hist->max_us)
+		hist->max_us = us;
+}
+
+/* Upper bound of the given percentile, in microseconds. */
+unsigned long long latency_hist_percentile(const struct latency_hist *hist,
+					   unsigned int percent)
+{
+	unsigned long long rank, seen = 0, us;
+	unsigned int i;
+
+	if (!hist->count)
+		return 0;
+
+	rank = (hist->count * percent + 99) / 100;
+	for (i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen >= rank)
+			break;
+	}
+
+	us = latency_bucket_max(i < LATENCY_HIST_BUCKETS ? i : LATENCY_HIST_BUCKETS - 1);
+
+	return us < hist->max_us ? us : hist->max_us;
+}
+
+void latency_hist_print(const struct latency_hist *hist, FILE *f,
+			const char *name, const char *stage)
+{
+	fprintf(f, "%s %s latency: n=%lu p50=%lluus p99=%lluus max=%lluus\n",
+		name, stage, hist->count,
+		latency_hist_percentile(hist, 50),
+		latency_hist_percentile(hist, 99),
+		hist->max_us);
+}
@@ -0,0 +1,40 @@
+#ifndef _LATENCY_H
+#define _LATENCY_H
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/time.h>
+
+/*
+ * Fixed bucket latency histogram: exact below 8 us, then 4 buckets per
+ * power of two (25% resolution) up to about 30 s. Recording a sample is a
+ * few arithmetic operations and an increment, no allocation nor lock.
+ */
+#define LATENCY_HIST_BUCKETS	96
+
+struct latency_hist {
+	unsigned long count;
+	unsigned long long max_us;
+	unsigned long buckets[LATENCY_HIST_BUCKETS];
+};
+
+static inline unsigned long long latency_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static inline unsigned long long latency_timeval_us(const struct timeval *tv)
+{
+	return tv->tv_sec * 1000000ULL + tv->tv_usec;
+}
+
+void latency_hist_add(struct latency_hist *hist, unsigned long long us);
+unsigned long long latency_hist_percentile(const struct latency_hist *hist,
+					   unsigned int percent);
+void latency_hist_print(const struct latency_hist *hist, FILE *f,
+			const char *name, const char *stage);
+
+#endif /* _LATENCY_H */
@@ -0,0 +1,248 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "latency.h"
+#include "launcher.h"
+
+#define LAUNCHER_EVENTS	(IN_CREATE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM | \
+			 IN_ATTRIB)
+
+extern char **environ;
+
+static void launcher_phase(struct launcher *launcher, const char *phase)
+{
+	unsigned long long now_us = latency_now_us();
+	unsigned long long us = now_us - launcher->phase_us;
+
+	fprintf(stderr, "launcher: %s in %llu.%03llu ms\n", phase, us / 1000,
+		us % 1000);
+	launcher->phase_us = now_us;
+}
+
+/* 1 if the module was unloaded, 0 if it wasn't loaded. */
+static int launcher_unload(void)
+{
+	if (access("/sys/module/" LAUNCHER_MODULE "/initstate", F_OK))
+		return 0;
+
+	if (syscall(SYS_delete_module, LAUNCHER_MODULE, O_NONBLOCK)) {
+		fprintf(stderr, "Can't unload %s: %s\n", LAUNCHER_MODULE,
+			strerror(errno));
+		return -1;
+	}
+
+	return 1;
+}
+
+/* modprobe resolves the module file and its dependencies. */
+static int launcher_load(const char *config)
+{
+	char param[256];
+	char *argv[] = { "modprobe", LAUNCHER_MODULE, param, NULL };
+	int ret, status;
+	pid_t pid;
+
+	snprintf(param, sizeof(param), "configuration_file=%s", config);
+
+	ret = posix_spawnp(&pid, "modprobe", NULL, NULL, argv, environ);
+	if (ret) {
+		fprintf(stderr, "Can't run modprobe: %s\n", strerror(ret));
+		return -1;
+	}
+
+	while (waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR) {
+			fprintf(stderr, "Can't wait for modprobe: %s\n",
+				strerror(errno));
+			return -1;
+		}
+	}
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+		fprintf(stderr, "Can't load %s with %s\n", LAUNCHER_MODULE, config);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Watch the directory of file, or its closest existing parent. */
+static void launcher_watch(int fd, const char *file)
+{
+	char dir[256];
+	char *slash;
+
+	snprintf(dir, sizeof(dir), "%s", file);
+
+	for (;;) {
+		slash = strrchr(dir, '/');
+		if (!slash)
+			strcpy(dir, ".");
+		else if (slash == dir)
+			slash[1] = '\0';
+		else
+			*slash = '\0';
+
+		if (inotify_add_watch(fd, dir, LAUNCHER_EVENTS) >= 0 ||
+		    errno != ENOENT || !slash || slash == dir)
+			return;
+	}
+}
+
+/*
+ * Wait for the input files to be all present and usable, or all gone. A
+ * present file is only usable once it can be opened: udev may still be
+ * setting its permissions.
+ */
+static int launcher_wait(struct launcher *launcher, const char * const *files,
+			 unsigned int nfiles, bool present, unsigned int timeout_ms)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	unsigned long long deadline_us, now_us;
+	bool done[LAUNCHER_MAX_FILES] = { false };
+	unsigned int i, pending, retry, wait_ms;
+	struct pollfd pfd;
+	int fd, ret = -1;
+
+	pfd.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (pfd.fd < 0) {
+		fprintf(stderr, "Can't init inotify: %s\n", strerror(errno));
+		return -1;
+	}
+	pfd.events = POLLIN;
+
+	deadline_us = latency_now_us() + timeout_ms * 1000ULL;
+
+	for (;;) {
+		pending = 0;
+		retry = 0;
+
+		for (i = 0; i < nfiles; i++) {
+			if (done[i])
+				continue;
+
+			/* Watched before the check, not to miss a change. */
+			launcher_watch(pfd.fd, files[i]);
+
+			if (present) {
+				fd = open(files[i], O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+				if (fd >= 0)
+					close(fd);
+				else if (errno != ENOENT)
+					retry++;
+				done[i] = fd >= 0;
+			} else {
+				done[i] = access(files[i], F_OK) && errno == ENOENT;
+			}
+
+			if (!done[i]) {
+				pending++;
+			} else if (present) {
+				now_us = latency_now_us() - launcher->phase_us;
+				fprintf(stderr, "launcher: %s ready after %llu.%03llu ms\n",
+					files[i], now_us / 1000, now_us % 1000);
+			}
+		}
+
+		if (!pending) {
+			ret = 0;
+			break;
+		}
+
+		now_us = latency_now_us();
+		if (now_us >= deadline_us) {
+			for (i = 0; i < nfiles; i++)
+				if (!done[i])
+					fprintf(stderr, "launcher: %s still %s after %u ms\n",
+						files[i], present ? "not usable" : "present",
+						timeout_ms);
+			break;
+		}
+
+		wait_ms = (deadline_us - now_us + 999) / 1000;
+		if (retry && wait_ms > LAUNCHER_RETRY_MS)
+			wait_ms = LAUNCHER_RETRY_MS;
+
+		if (poll(&pfd, 1, wait_ms) < 0 && errno != EINTR) {
+			fprintf(stderr, "Can't wait for the input files: %s\n",
+				strerror(errno));
+			break;
+		}
+
+		/* The events only say when to check again. */
+		while (read(pfd.fd, buf, sizeof(buf)) > 0)
+			;
+	}
+
+	close(pfd.fd);
+	return ret;
+}
+
+/*
+ * Reload the module and wait for the input files of the demo, if
+ * launching. Called before the demo opens anything.
+ */
+int launcher_start(struct launcher *launcher, const char * const *input_files,
+		   unsigned int nfiles)
+{
+	int ret;
+
+	if (!launcher->config)
+		return 0;
+
+	if (nfiles > LAUNCHER_MAX_FILES) {
+		fprintf(stderr, "launcher: %u input files, at most %d\n", nfiles,
+			LAUNCHER_MAX_FILES);
+		return -1;
+	}
+
+	launcher->start_us = latency_now_us();
+	launcher->phase_us = launcher->start_us;
+
+	ret = launcher_unload();
+	if (ret < 0)
+		return -1;
+
+	if (ret) {
+		launcher_phase(launcher, "module unloaded");
+
+		/* Not fatal: the files left are replaced when the module is back. */
+		launcher_wait(launcher, input_files, nfiles, false,
+			      LAUNCHER_REMOVE_TIMEOUT_MS);
+		launcher_phase(launcher, "input files removed");
+	}
+
+	if (launcher_load(launcher->config))
+		return -1;
+	launcher_phase(launcher, "module loaded");
+
+	if (launcher_wait(launcher, input_files, nfiles, true, LAUNCHER_TIMEOUT_MS))
+		return -1;
+	launcher_phase(launcher, "input files ready");
+
+	return 0;
+}
+
+/* Called once the demo is initialized, before it runs its loop. */
+void launcher_ready(struct launcher *launcher)
+{
+	unsigned long long us;
+
+	if (!launcher->config)
+		return;
+
+	launcher_phase(launcher, "demo initialized");
+	us = launcher->phase_us - launcher->start_us;
+	fprintf(stderr, "launcher: ready %llu.%03llu ms after launch\n",
+		us / 1000, us % 1000);
+}
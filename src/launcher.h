@@ -0,0 +1,36 @@
+#ifndef _LAUNCHER_H
+#define _LAUNCHER_H
+
+/*
+ * Launcher mode of the demos, in place of the start_ptc_* scripts: the
+ * atmel_ptc module is (re)loaded with the given configuration file, then
+ * the demo waits, with inotify, for its own input files only and opens
+ * them as soon as they are usable. The time taken by each phase is
+ * printed, up to the demo being ready.
+ */
+#define LAUNCHER_MODULE		"atmel_ptc"
+#define LAUNCHER_MAX_FILES	16
+/* Input files of the unloaded module still around after this are ignored. */
+#define LAUNCHER_REMOVE_TIMEOUT_MS	1000
+#define LAUNCHER_TIMEOUT_MS	5000
+/* Retry period for input files present but not usable yet. */
+#define LAUNCHER_RETRY_MS	10
+
+struct launcher {
+	/* Configuration file of the module, NULL if not launching. */
+	const char *config;
+	unsigned long long start_us;
+	unsigned long long phase_us;
+};
+
+#define LAUNCHER_INIT		{ .config = NULL }
+#define LAUNCHER_OPTSTRING	"l:"
+#define LAUNCHER_USAGE \
+	"  -l config   load the " LAUNCHER_MODULE " module with this configuration\n" \
+	"              file first, e.g. microchip/ptc_cfg_qt1_mutual.bin\n"
+
+int launcher_start(struct launcher *launcher, const char * const *input_files,
+		   unsigned int nfiles);
+void launcher_ready(struct launcher *launcher);
+
+#endif /* _LAUNCHER_H */
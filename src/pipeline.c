@@ -0,0 +1,221 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "pipeline.h"
+
+static void pipeline_wake(struct pipeline *pipeline)
+{
+	uint64_t one = 1;
+
+	/* Pairs with the waiting store and ring check of the output thread. */
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&pipeline->waiting, memory_order_relaxed) &&
+	    atomic_exchange(&pipeline->waiting, false))
+		if (write(pipeline->eventfd, &one, sizeof(one)) < 0)
+			fprintf(stderr, "Can't wake the output thread\n");
+}
+
+static void pipeline_push_pending(struct pipeline *pipeline, unsigned int skip)
+{
+	unsigned int i;
+
+	for (i = 0; pipeline->pending_mask && i < PIPELINE_MAX_DEVICES; i++) {
+		if (!(pipeline->pending_mask & (1u << i)) || i == skip)
+			continue;
+		if (!pipeline_ring_push(pipeline, &pipeline->pending[i])) {
+			atomic_store(&pipeline->full, true);
+			return;
+		}
+		pipeline->pending_mask &= ~(1u << i);
+		counter_inc(&pipeline->pushed);
+	}
+}
+
+/*
+ * Queue the new state of a device. When the output thread lags so much that
+ * the ring is full, the latest state of each device is kept aside and pushed
+ * once the output thread reports room again through room_fd, intermediate
+ * states are dropped.
+ */
+void pipeline_push(struct pipeline *pipeline, unsigned int device, int value,
+		   const struct timeval *time)
+{
+	struct pipeline_record rec = {
+		.time_us = latency_timeval_us(time),
+		.device = device,
+		.value = value,
+	};
+
+	pipeline_push_pending(pipeline, device);
+
+	if (pipeline_ring_push(pipeline, &rec)) {
+		pipeline->pending_mask &= ~(1u << device);
+		counter_inc(&pipeline->pushed);
+	} else {
+		pipeline->pending[device] = rec;
+		pipeline->pending_mask |= 1u << device;
+		counter_inc(&pipeline->overflows);
+		atomic_store(&pipeline->full, true);
+	}
+
+	pipeline_wake(pipeline);
+}
+
+/* To be called by the input thread when room_fd is readable. */
+int pipeline_room_handler(struct pipeline *pipeline)
+{
+	uint64_t count;
+
+	if (read(pipeline->room_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		return -1;
+
+	pipeline_push_pending(pipeline, PIPELINE_MAX_DEVICES);
+	pipeline_wake(pipeline);
+	return 0;
+}
+
+/* Output thread: the ring has room again for records kept aside. */
+static void pipeline_signal_room(struct pipeline *pipeline)
+{
+	uint64_t one = 1;
+
+	if (atomic_load(&pipeline->full) && atomic_exchange(&pipeline->full, false) &&
+	    write(pipeline->room_fd, &one, sizeof(one)) < 0)
+		fprintf(stderr, "Can't wake the input thread\n");
+}
+
+static void pipeline_wait(struct pipeline *pipeline)
+{
+	uint64_t count;
+
+	atomic_store(&pipeline->waiting, true);
+	atomic_thread_fence(memory_order_seq_cst);
+	/*
+	 * full may have been set after the ring was drained: either it is seen
+	 * here, or the input thread sees waiting and wakes this thread up.
+	 */
+	pipeline_signal_room(pipeline);
+	if (atomic_load_explicit(&pipeline->head, memory_order_relaxed) ==
+	    atomic_load_explicit(&pipeline->tail, memory_order_relaxed) &&
+	    !atomic_load(&pipeline->stop)) {
+		if (read(pipeline->eventfd, &count, sizeof(count)) < 0 &&
+		    errno != EINTR)
+			fprintf(stderr, "Can't wait for the input thread\n");
+	}
+	atomic_store(&pipeline->waiting, false);
+}
+
+static void *pipeline_thread(void *arg)
+{
+	struct pipeline *pipeline = arg;
+	struct pipeline_record rec;
+	unsigned long long now_us;
+	unsigned int updated, i;
+
+	while (!atomic_load(&pipeline->stop)) {
+		updated = 0;
+		while (pipeline_ring_pop(pipeline, &rec)) {
+			if (rec.device >= PIPELINE_MAX_DEVICES)
+				continue;
+			if (updated & (1u << rec.device))
+				counter_inc(&pipeline->coalesced);
+			pipeline->state[rec.device] = rec;
+			updated |= 1u << rec.device;
+		}
+
+		if (!updated) {
+			pipeline_wait(pipeline);
+			continue;
+		}
+
+		pipeline_signal_room(pipeline);
+
+		pipeline->output(pipeline->state, updated, pipeline->arg);
+		counter_inc(&pipeline->outputs);
+
+		now_us = latency_now_us();
+		for (i = 0; i < PIPELINE_MAX_DEVICES; i++)
+			if ((updated & (1u << i)) && now_us >= pipeline->state[i].time_us)
+				latency_hist_add(&pipeline->output_latency,
+						 now_us - pipeline->state[i].time_us);
+	}
+
+	return NULL;
+}
+
+struct pipeline *pipeline_start(void (*output)(const struct pipeline_record *state,
+					       unsigned int updated, void *arg),
+				void *arg)
+{
+	struct pipeline *pipeline;
+
+	pipeline = aligned_alloc(64, (sizeof(*pipeline) + 63) & ~63UL);
+	if (!pipeline) {
+		fprintf(stderr, "Can't allocate pipeline\n");
+		return NULL;
+	}
+	memset(pipeline, 0, sizeof(*pipeline));
+	atomic_init(&pipeline->head, 0);
+	atomic_init(&pipeline->tail, 0);
+	atomic_init(&pipeline->waiting, false);
+	atomic_init(&pipeline->full, false);
+	atomic_init(&pipeline->stop, false);
+	pipeline->output = output;
+	pipeline->arg = arg;
+
+	pipeline->room_fd = -1;
+	pipeline->eventfd = eventfd(0, EFD_CLOEXEC);
+	if (pipeline->eventfd < 0) {
+		fprintf(stderr, "Can't create pipeline eventfd\n");
+		goto out;
+	}
+
+	pipeline->room_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (pipeline->room_fd < 0) {
+		fprintf(stderr, "Can't create pipeline eventfd\n");
+		goto out;
+	}
+
+	if (pthread_create(&pipeline->thread, NULL, pipeline_thread, pipeline)) {
+		fprintf(stderr, "Can't start output thread\n");
+		goto out;
+	}
+
+	return pipeline;
+
+out:
+	if (pipeline->room_fd >= 0)
+		close(pipeline->room_fd);
+	if (pipeline->eventfd >= 0)
+		close(pipeline->eventfd);
+	free(pipeline);
+	return NULL;
+}
+
+/* Stop the output thread, its counters can be read safely afterwards. */
+void pipeline_stop(struct pipeline *pipeline)
+{
+	uint64_t one = 1;
+
+	if (atomic_exchange(&pipeline->stop, true))
+		return;
+
+	if (write(pipeline->eventfd, &one, sizeof(one)) < 0)
+		fprintf(stderr, "Can't wake the output thread\n");
+	pthread_join(pipeline->thread, NULL);
+}
+
+void pipeline_free(struct pipeline *pipeline)
+{
+	if (!pipeline)
+		return;
+
+	pipeline_stop(pipeline);
+	close(pipeline->room_fd);
+	close(pipeline->eventfd);
+	free(pipeline);
+}
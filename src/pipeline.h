@@ -0,0 +1,93 @@
+#ifndef _PIPELINE_H
+#define _PIPELINE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "counter.h"
+#include "latency.h"
+
+/*
+ * Input and output decoupled by a lock-free single producer, single
+ * consumer ring: the input thread pushes the state of its devices as
+ * compact records, the output thread keeps only the latest record of each
+ * device and drives the outputs with it. A slow output delays the LEDs but
+ * never the reading of the input devices.
+ */
+#define PIPELINE_RING_SIZE	1024	/* power of two */
+#define PIPELINE_MAX_DEVICES	8
+
+struct pipeline_record {
+	uint64_t time_us;
+	uint32_t device;
+	int32_t value;
+};
+
+struct pipeline {
+	/* Producer and consumer indexes on their own cache lines. */
+	_Alignas(64) atomic_uint head;
+	_Alignas(64) atomic_uint tail;
+	_Alignas(64) struct pipeline_record ring[PIPELINE_RING_SIZE];
+	/* Input thread only: records not pushed because the ring was full. */
+	struct pipeline_record pending[PIPELINE_MAX_DEVICES];
+	unsigned int pending_mask;
+	atomic_ulong pushed;
+	atomic_ulong overflows;
+	/* Output thread only. */
+	struct pipeline_record state[PIPELINE_MAX_DEVICES];
+	atomic_ulong outputs;
+	atomic_ulong coalesced;
+	struct latency_hist output_latency;
+	/* Called with the latest record of each device, updated is a mask. */
+	void (*output)(const struct pipeline_record *state, unsigned int updated,
+		       void *arg);
+	void *arg;
+	atomic_bool waiting;
+	atomic_bool full;
+	atomic_bool stop;
+	int eventfd;
+	/* Readable when the ring has room again after being full. */
+	int room_fd;
+	pthread_t thread;
+};
+
+static inline bool pipeline_ring_push(struct pipeline *pipeline,
+				      const struct pipeline_record *rec)
+{
+	unsigned int head = atomic_load_explicit(&pipeline->head, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&pipeline->tail, memory_order_acquire);
+
+	if (head - tail == PIPELINE_RING_SIZE)
+		return false;
+
+	pipeline->ring[head & (PIPELINE_RING_SIZE - 1)] = *rec;
+	atomic_store_explicit(&pipeline->head, head + 1, memory_order_release);
+	return true;
+}
+
+static inline bool pipeline_ring_pop(struct pipeline *pipeline,
+				     struct pipeline_record *rec)
+{
+	unsigned int tail = atomic_load_explicit(&pipeline->tail, memory_order_relaxed);
+	unsigned int head = atomic_load_explicit(&pipeline->head, memory_order_acquire);
+
+	if (head == tail)
+		return false;
+
+	*rec = pipeline->ring[tail & (PIPELINE_RING_SIZE - 1)];
+	atomic_store_explicit(&pipeline->tail, tail + 1, memory_order_release);
+	return true;
+}
+
+struct pipeline *pipeline_start(void (*output)(const struct pipeline_record *state,
+					       unsigned int updated, void *arg),
+				void *arg);
+void pipeline_push(struct pipeline *pipeline, unsigned int device, int value,
+		   const struct timeval *time);
+int pipeline_room_handler(struct pipeline *pipeline);
+void pipeline_stop(struct pipeline *pipeline);
+void pipeline_free(struct pipeline *pipeline);
+
+#endif /* _PIPELINE_H */
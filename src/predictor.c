@@ -0,0 +1,106 @@
+#include <string.h>
+
+#include "predictor.h"
+
+/* Shortest way from one position to another, across max/min for wheels. */
+static int64_t predictor_wrap_delta(const struct predictor *p, int64_t delta)
+{
+	int64_t range = (int64_t)p->range << PREDICTOR_SHIFT;
+
+	if (!p->wrap)
+		return delta;
+
+	delta %= range;
+	if (delta >= range / 2)
+		delta -= range;
+	else if (delta < -range / 2)
+		delta += range;
+
+	return delta;
+}
+
+static int64_t predictor_wrap_pos(const struct predictor *p, int64_t pos)
+{
+	int64_t range = (int64_t)p->range << PREDICTOR_SHIFT;
+
+	if (p->wrap) {
+		pos %= range;
+		if (pos < 0)
+			pos += range;
+	} else if (pos < 0) {
+		pos = 0;
+	} else if (pos > range - PREDICTOR_ONE) {
+		pos = range - PREDICTOR_ONE;
+	}
+
+	return pos;
+}
+
+void predictor_init(struct predictor *p, int min, int max, bool wrap,
+		    unsigned int lead_ms)
+{
+	memset(p, 0, sizeof(*p));
+	p->min = min;
+	p->range = max >= min ? max - min + 1 : 1;
+	p->wrap = wrap;
+	p->lead_us = lead_ms * 1000;
+	p->alpha = PREDICTOR_ALPHA;
+	p->beta = PREDICTOR_BETA;
+}
+
+/* To be called on release: the next touch starts from its own position. */
+void predictor_reset(struct predictor *p)
+{
+	p->valid = false;
+}
+
+int predictor_delta(const struct predictor *p, int from, int to)
+{
+	return predictor_wrap_delta(p, (int64_t)(to - from) << PREDICTOR_SHIFT) /
+		PREDICTOR_ONE;
+}
+
+/*
+ * Feed a position reported at time_us, return the position to display. The
+ * first report of a touch is returned as is, it has no speed yet.
+ */
+int predictor_update(struct predictor *p, int value, uint64_t time_us)
+{
+	int64_t x, predicted, residual, step, lead, bound, out;
+	uint64_t dt;
+
+	x = (int64_t)(value - p->min) << PREDICTOR_SHIFT;
+
+	if (!p->valid || time_us <= p->last_us ||
+	    time_us - p->last_us > PREDICTOR_MAX_GAP_US) {
+		p->pos = predictor_wrap_pos(p, x);
+		p->vel = 0;
+		p->last_value = p->pos;
+		p->last_us = time_us;
+		p->valid = true;
+		return value;
+	}
+
+	dt = time_us - p->last_us;
+
+	predicted = p->pos + p->vel * (int64_t)dt / 1000;
+	residual = predictor_wrap_delta(p, x - predicted);
+	p->pos = predictor_wrap_pos(p, predicted + p->alpha * residual / PREDICTOR_ONE);
+	p->vel += p->beta * residual / PREDICTOR_ONE * 1000 / (int64_t)dt;
+
+	/* No further than the last measured speed would go. */
+	step = predictor_wrap_delta(p, x - p->last_value);
+	bound = (step < 0 ? -step : step) * p->lead_us / (int64_t)dt;
+	lead = p->vel * p->lead_us / 1000;
+	if (lead > bound)
+		lead = bound;
+	else if (lead < -bound)
+		lead = -bound;
+
+	p->last_value = x;
+	p->last_us = time_us;
+
+	out = predictor_wrap_pos(p, p->pos + lead + PREDICTOR_ONE / 2);
+
+	return p->min + out / PREDICTOR_ONE;
+}
@@ -0,0 +1,45 @@
+#ifndef _PREDICTOR_H
+#define _PREDICTOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Alpha-beta filter on a slider or wheel position, in 16.16 fixed point,
+ * extrapolating the filtered position lead_us ahead so that the LEDs catch
+ * up with the finger. Wheel positions wrap around from max to min.
+ *
+ * The extrapolation never goes further than the last measured speed would
+ * take the finger: when it stops, evdev sends no more events and the last
+ * prediction stays displayed until the next touch event.
+ */
+#define PREDICTOR_SHIFT		16
+#define PREDICTOR_ONE		(1 << PREDICTOR_SHIFT)
+/* Critically damped: beta = alpha^2 / (2 - alpha). */
+#define PREDICTOR_ALPHA		(PREDICTOR_ONE * 6 / 10)
+#define PREDICTOR_BETA		(PREDICTOR_ONE * 26 / 100)
+/* Longer gaps between two reports restart the filter. */
+#define PREDICTOR_MAX_GAP_US	100000
+
+struct predictor {
+	int min;
+	int range;
+	bool wrap;
+	unsigned int lead_us;
+	int32_t alpha;
+	int32_t beta;
+	bool valid;
+	/* Position from min and speed per ms, 16.16 fixed point. */
+	int64_t pos;
+	int64_t vel;
+	int64_t last_value;
+	uint64_t last_us;
+};
+
+void predictor_init(struct predictor *p, int min, int max, bool wrap,
+		    unsigned int lead_ms);
+void predictor_reset(struct predictor *p);
+int predictor_update(struct predictor *p, int value, uint64_t time_us);
+int predictor_delta(const struct predictor *p, int from, int to);
+
+#endif /* _PREDICTOR_H */
@@ -0,0 +1,843 @@
+/*
+ * Benchmarks for the PTC QTx library.
+ *
+ * The benchmarks run on synthetic atmel_ptc devices created with uinput,
+ * no PTC hardware is needed. Results are printed as one JSON object per
+ * line.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libevdev-1.0/libevdev/libevdev.h>
+
+#include "event_loop.h"
+#include "event_trace.h"
+#include "gpio_helper.h"
+#include "is31fl3728.h"
+#include "pipeline.h"
+#include "predictor.h"
+#include "ptc_qt.h"
+#include "rt.h"
+#include "uinput_helper.h"
+
+#define BENCH_DEVICE_NAME	"atmel_ptc bench"
+#define BENCH_ABS_MAX		63
+/* Frames injected at once, small enough not to overflow the evdev buffer. */
+#define BENCH_BATCH_FRAMES	16
+#define BENCH_DEFAULT_FRAMES	200000
+#define BENCH_DEFAULT_RATE	1000
+#define BENCH_DEFAULT_DURATION	5
+#define BENCH_IS31FL3728_ADDR	0x60
+#define BENCH_DEFAULT_LEAD_MS	10
+
+struct bench_options {
+	unsigned long nframes;
+	unsigned int rate;
+	unsigned int duration;
+	const char *gpiochip;
+	const char *i2c_file;
+	bool bulk;
+	bool pipelined;
+	bool uring;
+	unsigned int lead_ms;
+	struct rt_options rt;
+};
+
+struct bench_producer {
+	struct uinput_device *dev;
+	unsigned int rate;
+	bool rt;
+	unsigned long long end_ns;
+	unsigned long frames_sent;
+	atomic_bool done;
+	int error;
+};
+
+/* Slider LEDs on the first lines of the simulated chip. */
+static const struct gpio_led_desc bench_leds[] = {
+	{ .pin_id = 0 }, { .pin_id = 1 }, { .pin_id = 2 }, { .pin_id = 3 },
+	{ .pin_id = 4 }, { .pin_id = 5 }, { .pin_id = 6 }, { .pin_id = 7 },
+};
+
+static struct is31fl3728 bench_matrix = { .fd = -1 };
+static struct gpio_led_bank *bench_bank;
+static struct pipeline *bench_pipeline;
+static unsigned long resync_frames;
+static unsigned long events_received;
+
+static unsigned long frames_received;
+
+static void bench_frame_update(struct scroller *scroller,
+			       const struct scroller_frame *frame, void *arg)
+{
+	frames_received++;
+}
+
+static int bench_create_scroller(struct uinput_device *dev)
+{
+	static const unsigned int keys[] = { BTN_TOUCH };
+	static const struct uinput_abs abs[] = {
+		{ .code = ABS_X, .info = { .minimum = 0, .maximum = BENCH_ABS_MAX } },
+	};
+	struct input_id id = { .bustype = BUS_VIRTUAL };
+
+	return uinput_create(dev, BENCH_DEVICE_NAME, &id, keys, 1, abs, 1);
+}
+
+static unsigned long long bench_now_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bench_set_event(struct input_event *ev, unsigned int type,
+			    unsigned int code, int value)
+{
+	memset(ev, 0, sizeof(*ev));
+	ev->type = type;
+	ev->code = code;
+	ev->value = value;
+}
+
+/*
+ * Compare the libevdev read path with the bulk read path: the same frames
+ * are injected for both, only the time spent in scroller_event_handler() is
+ * accounted.
+ */
+static int bench_read(struct uinput_device *dev, bool bulk,
+		      unsigned long nframes)
+{
+	struct input_event batch[BENCH_BATCH_FRAMES * 2 + 2];
+	unsigned long long wall_ns = 0, cpu_ns = 0, t0, c0;
+	unsigned long sent = 0, events = 0;
+	struct scroller *scroller;
+	unsigned int i, n;
+	int ret = -1;
+
+	scroller = initialize_scroller_frames(dev->event_file, NULL, 0,
+					      bench_frame_update);
+	if (!scroller)
+		return -1;
+
+	if (bulk && scroller_set_bulk_read(scroller, true))
+		goto out;
+
+	frames_received = 0;
+	while (sent < nframes) {
+		n = 0;
+		if (!sent)
+			bench_set_event(&batch[n++], EV_KEY, BTN_TOUCH, 1);
+		for (i = 0; i < BENCH_BATCH_FRAMES && sent < nframes; i++, sent++) {
+			/* The input core drops ABS events repeating the last value. */
+			bench_set_event(&batch[n++], EV_ABS, ABS_X,
+					sent % (BENCH_ABS_MAX + 1));
+			bench_set_event(&batch[n++], EV_SYN, SYN_REPORT, 0);
+		}
+		if (uinput_emit(dev, batch, n))
+			goto out;
+		events += n;
+
+		t0 = bench_now_ns(CLOCK_MONOTONIC);
+		c0 = bench_now_ns(CLOCK_THREAD_CPUTIME_ID);
+		if (scroller_event_handler(scroller, NULL))
+			goto out;
+		cpu_ns += bench_now_ns(CLOCK_THREAD_CPUTIME_ID) - c0;
+		wall_ns += bench_now_ns(CLOCK_MONOTONIC) - t0;
+	}
+
+	printf("{\"bench\":\"read\",\"path\":\"%s\",\"events\":%lu,"
+	       "\"frames_sent\":%lu,\"frames_received\":%lu,"
+	       "\"events_per_sec\":%.0f,\"cpu_ns_per_event\":%.1f}\n",
+	       bulk ? "bulk" : "libevdev", events, sent, frames_received,
+	       wall_ns ? events * 1e9 / wall_ns : 0.0,
+	       events ? (double)cpu_ns / events : 0.0);
+	ret = 0;
+
+out:
+	remove_scroller(scroller);
+	return ret;
+}
+
+/*
+ * Same LED output as the demos: a bar on the GPIO LEDs and one dot on the
+ * LED matrix, all off for a negative position.
+ */
+static void bench_leds_update(int position)
+{
+	if (bench_bank && bench_bank->nleds)
+		gpio_led_bank_set(bench_bank,
+				  position < 0 ? 0 : (2u << (position / 8)) - 1);
+
+	if (bench_matrix.fd >= 0) {
+		is31fl3728_clear(&bench_matrix);
+		if (position >= 0)
+			is31fl3728_set_column(&bench_matrix, position / 8,
+					      1u << (position % 8));
+		is31fl3728_flush(&bench_matrix);
+	}
+}
+
+static void bench_pipeline_output(const struct pipeline_record *state,
+				  unsigned int updated, void *arg)
+{
+	bench_leds_update(state[0].value);
+}
+
+static void bench_rate_frame_update(struct scroller *scroller,
+				    const struct scroller_frame *frame, void *arg)
+{
+	bool off = frame->has_key && frame->key_value == 0;
+	int position = off ? -1 : (int)frame->abs_value;
+
+	frames_received++;
+	events_received += frame->nevents + 1;
+	if (frame->resync)
+		resync_frames++;
+
+	if (!off && !frame->has_abs)
+		return;
+
+	if (bench_pipeline)
+		pipeline_push(bench_pipeline, 0, position, &frame->time);
+	else
+		bench_leds_update(position);
+}
+
+/* Slider position sweeping back and forth, never repeating a value. */
+static int bench_position(unsigned long frame)
+{
+	unsigned int period = 2 * BENCH_ABS_MAX;
+	unsigned int phase = frame % period;
+
+	return phase <= BENCH_ABS_MAX ? phase : period - phase;
+}
+
+/*
+ * Inject frames at the requested rate, in batches of the frames due every
+ * millisecond, or as fast as possible when rate is 0.
+ */
+static void *bench_producer_thread(void *arg)
+{
+	struct bench_producer *producer = arg;
+	struct input_event batch[BENCH_BATCH_FRAMES * 2 + 2];
+	unsigned long long start_ns, now_ns, due;
+	struct timespec next;
+	unsigned int n;
+
+	/* Only the consumer runs in the realtime mode being measured. */
+	if (producer->rt)
+		rt_thread_default();
+
+	start_ns = bench_now_ns(CLOCK_MONOTONIC);
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	n = 0;
+	bench_set_event(&batch[n++], EV_KEY, BTN_TOUCH, 1);
+	while ((now_ns = bench_now_ns(CLOCK_MONOTONIC)) < producer->end_ns) {
+		if (producer->rate)
+			due = (now_ns - start_ns) * producer->rate / 1000000000ULL;
+		else
+			due = producer->frames_sent + BENCH_BATCH_FRAMES;
+
+		while (producer->frames_sent < due) {
+			while (n < BENCH_BATCH_FRAMES * 2 && producer->frames_sent < due) {
+				bench_set_event(&batch[n++], EV_ABS, ABS_X,
+						bench_position(producer->frames_sent++));
+				bench_set_event(&batch[n++], EV_SYN, SYN_REPORT, 0);
+			}
+			if (uinput_emit(producer->dev, batch, n)) {
+				producer->error = -1;
+				goto out;
+			}
+			n = 0;
+		}
+
+		if (producer->rate) {
+			next.tv_nsec += 1000000;
+			if (next.tv_nsec >= 1000000000) {
+				next.tv_nsec -= 1000000000;
+				next.tv_sec++;
+			}
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		}
+	}
+
+	bench_set_event(&batch[0], EV_KEY, BTN_TOUCH, 0);
+	bench_set_event(&batch[1], EV_SYN, SYN_REPORT, 0);
+	if (uinput_emit(producer->dev, batch, 2))
+		producer->error = -1;
+	else
+		producer->frames_sent++;
+
+out:
+	atomic_store(&producer->done, true);
+	return NULL;
+}
+
+static int bench_scroller_handler(int fd, uint32_t events, void *arg)
+{
+	return scroller_event_handler(arg, NULL);
+}
+
+static void *bench_scroller_buffer(void *arg, size_t *size)
+{
+	return scroller_bulk_buffer(arg, size);
+}
+
+static int bench_scroller_read(int fd, ssize_t len, void *arg)
+{
+	return scroller_bulk_complete(arg, len, NULL);
+}
+
+static int bench_pipeline_handler(int fd, uint32_t events, void *arg)
+{
+	return pipeline_room_handler(arg);
+}
+
+static int bench_end_handler(void *arg)
+{
+	struct bench_producer *producer = arg;
+
+	/* Give the last frames injected the time to be read. */
+	return atomic_load(&producer->done) ? 1 : 0;
+}
+
+/*
+ * Inject frames from another thread at a fixed rate while the scroller is
+ * run from the event loop as in the demos, driving simulated LEDs.
+ */
+static int bench_rate(struct uinput_device *dev, const struct bench_options *opts)
+{
+	struct bench_producer producer = {
+		.dev = dev,
+		.rate = opts->rate,
+		.rt = opts->rt.priority || opts->rt.cpu >= 0,
+	};
+	unsigned long long wall_ns, cpu_ns, t0, c0;
+	const struct latency_hist *led_latency;
+	struct scroller *scroller = NULL;
+	struct event_loop *loop;
+	const char *path;
+	pthread_t thread;
+	int ret = -1;
+
+	loop = opts->uring ? event_loop_new_uring() : event_loop_new();
+	if (!loop)
+		return -1;
+
+	scroller = initialize_scroller_frames(dev->event_file,
+					      opts->gpiochip ? bench_leds : NULL,
+					      opts->gpiochip ? 8 : 0,
+					      bench_rate_frame_update);
+	if (!scroller)
+		goto out;
+
+	if (event_loop_is_uring(loop)) {
+		path = "io_uring";
+		if (scroller_set_bulk_read(scroller, true) ||
+		    !event_loop_add_read(loop, scroller->fd, 0, bench_scroller_buffer,
+					 bench_scroller_read, scroller))
+			goto out;
+
+		/* The output thread can't queue writes on the loop. */
+		if (!opts->pipelined && bench_matrix.fd >= 0)
+			is31fl3728_set_loop(&bench_matrix, loop);
+	} else {
+		path = opts->bulk ? "bulk" : "libevdev";
+		if ((opts->bulk && scroller_set_bulk_read(scroller, true)) ||
+		    !event_loop_add_fd(loop, scroller->fd, 0, 0,
+				       bench_scroller_handler, scroller))
+			goto out;
+	}
+
+	if (!event_loop_add_timer(loop, 100, -1, bench_end_handler, &producer))
+		goto out;
+
+	bench_bank = &scroller->bank;
+	if (opts->pipelined) {
+		bench_pipeline = pipeline_start(bench_pipeline_output, NULL);
+		if (!bench_pipeline ||
+		    !event_loop_add_fd(loop, bench_pipeline->room_fd, 0, 0,
+				       bench_pipeline_handler, bench_pipeline))
+			goto out;
+	}
+
+	frames_received = 0;
+	events_received = 0;
+	resync_frames = 0;
+	atomic_init(&producer.done, false);
+
+	t0 = bench_now_ns(CLOCK_MONOTONIC);
+	c0 = bench_now_ns(CLOCK_THREAD_CPUTIME_ID);
+	producer.end_ns = t0 + opts->duration * 1000000000ULL;
+	if (pthread_create(&thread, NULL, bench_producer_thread, &producer)) {
+		fprintf(stderr, "Can't start producer thread\n");
+		goto out;
+	}
+
+	ret = event_loop_run(loop) < 0 ? -1 : 0;
+	pthread_join(thread, NULL);
+	if (producer.error)
+		ret = -1;
+	if (bench_pipeline)
+		pipeline_stop(bench_pipeline);
+	led_latency = bench_pipeline ? &bench_pipeline->output_latency :
+				       &scroller->total_latency;
+
+	cpu_ns = bench_now_ns(CLOCK_THREAD_CPUTIME_ID) - c0;
+	wall_ns = bench_now_ns(CLOCK_MONOTONIC) - t0;
+
+	printf("{\"bench\":\"rate\",\"path\":\"%s\",\"target_rate\":%u,"
+	       "\"duration_s\":%u,\"rt_priority\":%d,\"pipelined\":%s,"
+	       "\"frames_sent\":%lu,\"frames_received\":%lu,"
+	       "\"frames_dropped\":%ld,\"sync_dropped\":%lu,\"resync_frames\":%lu,"
+	       "\"events_per_sec\":%.0f,\"cpu_percent\":%.2f,"
+	       "\"latency_p50_us\":%llu,\"latency_p99_us\":%llu,\"latency_max_us\":%llu,"
+	       "\"read_latency_p99_us\":%llu,"
+	       "\"led_latency_p50_us\":%llu,\"led_latency_p99_us\":%llu,"
+	       "\"gpio_writes\":%lu,\"gpio_skipped\":%lu,\"i2c_transfers\":%lu}\n",
+	       path, opts->rate, opts->duration,
+	       opts->rt.priority, opts->pipelined ? "true" : "false",
+	       producer.frames_sent, frames_received,
+	       (long)(producer.frames_sent - frames_received),
+	       scroller->sync_dropped, resync_frames,
+	       events_received * 1e9 / wall_ns, cpu_ns * 100.0 / wall_ns,
+	       latency_hist_percentile(&scroller->total_latency, 50),
+	       latency_hist_percentile(&scroller->total_latency, 99),
+	       scroller->total_latency.max_us,
+	       latency_hist_percentile(&scroller->read_latency, 99),
+	       latency_hist_percentile(led_latency, 50),
+	       latency_hist_percentile(led_latency, 99),
+	       scroller->bank.writes, scroller->bank.skipped,
+	       bench_matrix.fd >= 0 ? bench_matrix.transfers : 0);
+
+out:
+	pipeline_free(bench_pipeline);
+	bench_pipeline = NULL;
+	bench_bank = NULL;
+	bench_matrix.loop = NULL;
+	if (scroller)
+		remove_scroller(scroller);
+	event_loop_free(loop);
+	return ret;
+}
+
+struct bench_sample {
+	uint64_t time_us;
+	int value;
+	unsigned int stroke;
+};
+
+/* Touched positions of a traced device, one per frame reporting one. */
+static size_t bench_trace_samples(const struct event_trace *trace,
+				  unsigned int device, unsigned int abs_code,
+				  struct bench_sample *samples)
+{
+	bool has_abs = false, released = false, lifted = false;
+	unsigned int stroke = 0;
+	size_t i, n = 0;
+	int value = 0;
+
+	for (i = 0; i < trace->nrecords; i++) {
+		const struct event_trace_record *rec = &trace->records[i];
+
+		if (rec->device != device)
+			continue;
+
+		if (rec->type == EV_ABS && rec->code == abs_code) {
+			has_abs = true;
+			value = rec->value;
+		} else if (rec->type == EV_KEY && !rec->value) {
+			released = true;
+		} else if (rec->type == EV_SYN && rec->code == SYN_REPORT) {
+			if (released) {
+				lifted = true;
+			} else if (has_abs) {
+				if (n && (lifted || rec->time_us - samples[n - 1].time_us >
+						    PREDICTOR_MAX_GAP_US))
+					stroke++;
+				lifted = false;
+				samples[n].time_us = rec->time_us;
+				samples[n].value = value;
+				samples[n].stroke = stroke;
+				n++;
+			}
+			has_abs = released = false;
+		}
+	}
+
+	return n;
+}
+
+/* Slider position sweeping back and forth, dithering by one on the way. */
+static int bench_hold_position(unsigned long frame)
+{
+	static const int dither[] = { 0, 1, 0, -1 };
+	int position = bench_position(frame / 4) + dither[frame % 4];
+
+	return position < 0 ? 0 : position > BENCH_ABS_MAX ? BENCH_ABS_MAX : position;
+}
+
+/*
+ * Sweep a dithering finger over the slider range with the LED hysteresis
+ * of the demos and check what is displayed: with margin 0 always the LEDs
+ * of the position, otherwise those of a position at most margin away.
+ */
+static int bench_hold_map(struct uinput_device *dev, enum scroller_led_map map,
+			  unsigned int nleds, unsigned int margin)
+{
+	bool wheel = map == SCROLLER_LED_WHEEL;
+	unsigned long frame, frames = 4 * 2 * BENCH_ABS_MAX;
+	unsigned long mismatches = 0, changes = 0;
+	unsigned int shown = 0;
+	struct input_event batch[2];
+	struct scroller *scroller;
+	int position, d, p, ret = -1;
+	bool match;
+
+	scroller = initialize_scroller_frames(dev->event_file, bench_leds, nleds,
+					      scroller_leds_frame_update);
+	if (!scroller)
+		return -1;
+
+	if (scroller_set_led_map(scroller, map) ||
+	    scroller_set_led_hysteresis(scroller, margin))
+		goto out;
+
+	bench_set_event(&batch[0], EV_KEY, BTN_TOUCH, 1);
+	bench_set_event(&batch[1], EV_SYN, SYN_REPORT, 0);
+	if (uinput_emit(dev, batch, 2) || scroller_event_handler(scroller, NULL))
+		goto out;
+
+	for (frame = 0; frame < frames; frame++) {
+		position = bench_hold_position(frame);
+		bench_set_event(&batch[0], EV_ABS, ABS_X, position);
+		if (uinput_emit(dev, batch, 2) ||
+		    scroller_event_handler(scroller, NULL))
+			goto out;
+
+		if (scroller->bank.values != shown)
+			changes++;
+		shown = scroller->bank.values;
+
+		match = false;
+		for (d = -(int)margin; d <= (int)margin && !match; d++) {
+			p = position + d;
+			if (wheel)
+				p = (p + BENCH_ABS_MAX + 1) % (BENCH_ABS_MAX + 1);
+			else if (p < 0 || p > BENCH_ABS_MAX)
+				continue;
+			match = scroller->led_masks[p] == shown;
+		}
+		if (!match)
+			mismatches++;
+	}
+
+	bench_set_event(&batch[0], EV_KEY, BTN_TOUCH, 0);
+	if (uinput_emit(dev, batch, 2) || scroller_event_handler(scroller, NULL))
+		goto out;
+
+	printf("{\"bench\":\"hold\",\"map\":\"%s\",\"leds\":%u,"
+	       "\"margin\":%u,\"frames\":%lu,\"held\":%lu,\"led_changes\":%lu,"
+	       "\"mismatches\":%lu}\n",
+	       wheel ? "wheel" : "bar", nleds, margin, frames,
+	       scroller->hysteresis.suppressed, changes, mismatches);
+	ret = mismatches ? -1 : 0;
+
+out:
+	remove_scroller(scroller);
+	return ret;
+}
+
+/*
+ * 7 LEDs on the bar and 3 on the wheel make 7 steps, which don't divide the
+ * 64 positions evenly: steps of 9 and 10 positions.
+ */
+static int bench_hold(struct uinput_device *dev)
+{
+	unsigned int margin;
+
+	for (margin = 0; margin <= 2; margin++)
+		if (bench_hold_map(dev, SCROLLER_LED_BAR, 7, margin) ||
+		    bench_hold_map(dev, SCROLLER_LED_WHEEL, 3, margin))
+			return -1;
+
+	return 0;
+}
+
+/*
+ * Position of the finger at time_us, interpolated between the samples of
+ * the stroke from index *j, which is advanced. Past the last sample of the
+ * stroke, the finger stopped or was lifted there.
+ */
+static double bench_trace_position(const struct predictor *p,
+				   const struct bench_sample *samples, size_t n,
+				   size_t *j, uint64_t time_us)
+{
+	const struct bench_sample *a, *b;
+
+	while (*j + 1 < n && samples[*j + 1].stroke == samples[*j].stroke &&
+	       samples[*j + 1].time_us <= time_us)
+		(*j)++;
+
+	a = &samples[*j];
+	if (*j + 1 >= n || samples[*j + 1].stroke != a->stroke || time_us <= a->time_us)
+		return a->value;
+
+	b = a + 1;
+	return a->value + (double)predictor_delta(p, a->value, b->value) *
+		(time_us - a->time_us) / (b->time_us - a->time_us);
+}
+
+/* Distance between two positions, across max/min for wheels. */
+static double bench_distance(const struct predictor *p, double from, double to)
+{
+	double d = to - from;
+
+	if (p->wrap) {
+		while (d >= p->range / 2.0)
+			d -= p->range;
+		while (d < -p->range / 2.0)
+			d += p->range;
+	}
+
+	return d;
+}
+
+/*
+ * Replay the touches of a trace through the predictor and compare what it
+ * displays at each frame with where the finger was lead_ms later, as given
+ * by the following frames. Without prediction the reported position is
+ * displayed: its error is the lag the prediction tries to remove, the
+ * latency reduction is the part of it removed, in ms at the same speed.
+ * Overshoot is a displayed position beyond where the finger went.
+ */
+static int bench_predict_device(const struct event_trace *trace,
+				unsigned int device, bool wheel,
+				unsigned int lead_ms)
+{
+	const struct event_trace_device *desc = &trace->header->devices[device];
+	double hold_error = 0, error = 0, overshoot = 0, overshoot_max = 0;
+	unsigned long overshoots = 0;
+	struct bench_sample *samples;
+	struct predictor predictor;
+	size_t i, j = 0, n;
+
+	if (!desc->nabs)
+		return 0;
+
+	samples = malloc(trace->nrecords * sizeof(*samples));
+	if (!samples) {
+		fprintf(stderr, "Can't allocate trace samples\n");
+		return -1;
+	}
+
+	n = bench_trace_samples(trace, device, desc->abs[0].code, samples);
+	predictor_init(&predictor, desc->abs[0].info.minimum,
+		       desc->abs[0].info.maximum, wheel, lead_ms);
+
+	for (i = 0; i < n; i++) {
+		double truth, shown, ahead, beyond;
+
+		if (i && samples[i].stroke != samples[i - 1].stroke)
+			predictor_reset(&predictor);
+		shown = predictor_update(&predictor, samples[i].value,
+					 samples[i].time_us);
+
+		if (j < i)
+			j = i;
+		truth = bench_trace_position(&predictor, samples, n, &j,
+					     samples[i].time_us + lead_ms * 1000);
+
+		hold_error += fabs(bench_distance(&predictor, samples[i].value, truth));
+		error += fabs(bench_distance(&predictor, shown, truth));
+
+		ahead = bench_distance(&predictor, samples[i].value, shown);
+		beyond = bench_distance(&predictor, truth, shown);
+		if ((ahead > 0 && beyond > 0) || (ahead < 0 && beyond < 0)) {
+			overshoots++;
+			overshoot += fabs(beyond);
+			if (fabs(beyond) > overshoot_max)
+				overshoot_max = fabs(beyond);
+		}
+	}
+
+	printf("{\"bench\":\"predict\",\"device\":\"%s\",\"wheel\":%s,"
+	       "\"lead_ms\":%u,\"frames\":%zu,\"strokes\":%u,"
+	       "\"hold_error\":%.3f,\"predicted_error\":%.3f,"
+	       "\"latency_reduction_ms\":%.2f,\"overshoot_frames\":%lu,"
+	       "\"overshoot_mean\":%.3f,\"overshoot_max\":%.3f}\n",
+	       desc->name, wheel ? "true" : "false", lead_ms, n,
+	       n ? samples[n - 1].stroke + 1 : 0,
+	       n ? hold_error / n : 0.0, n ? error / n : 0.0,
+	       hold_error ? lead_ms * (hold_error - error) / hold_error : 0.0,
+	       overshoots, overshoots ? overshoot / overshoots : 0.0,
+	       overshoot_max);
+
+	free(samples);
+	return 0;
+}
+
+static int bench_predict(const char *path, char **wheels, int nwheels,
+			 unsigned int lead_ms)
+{
+	struct event_trace trace;
+	unsigned int i;
+	int k, ret = 0;
+
+	if (event_trace_open(&trace, path))
+		return -1;
+
+	for (i = 0; i < trace.header->ndevices && !ret; i++) {
+		bool wheel = false;
+
+		for (k = 0; k < nwheels; k++)
+			if (strtoul(wheels[k], NULL, 0) == i)
+				wheel = true;
+
+		ret = bench_predict_device(&trace, i, wheel, lead_ms);
+	}
+
+	event_trace_close(&trace);
+	return ret;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] read|rate|hold|predict\n"
+		"  read  compare the libevdev and bulk evdev read paths\n"
+		"  rate  inject frames at a fixed rate and drive the LEDs\n"
+		"  hold  check the LEDs displayed with hysteresis (needs -g)\n"
+		"  predict trace [wheel-device...]\n"
+		"        evaluate the position prediction on a ptc_trace recording\n"
+		"options:\n"
+		"  -n frames   frames to inject for read (default %d)\n"
+		"  -r rate     frames per second for rate, 0 for saturation (default %d)\n"
+		"  -d seconds  duration of rate (default %d)\n"
+		"  -b          use the bulk read path for rate\n"
+		"  -t          drive the LEDs from an output thread for rate\n"
+		"  -u          use the io_uring event loop for rate\n"
+		"  -g chip     drive 8 slider LEDs on lines 0-7 of this gpio chip\n"
+		"              (gpio-sim, gpio-mockup)\n"
+		"  -i device   drive an IS31FL3728 at 0x%02x on this i2c bus (i2c-stub)\n"
+		"  -e ms       prediction lead for predict (default %d)\n"
+		RT_USAGE,
+		prog, BENCH_DEFAULT_FRAMES, BENCH_DEFAULT_RATE,
+		BENCH_DEFAULT_DURATION, BENCH_IS31FL3728_ADDR,
+		BENCH_DEFAULT_LEAD_MS);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_options opts = {
+		.nframes = BENCH_DEFAULT_FRAMES,
+		.rate = BENCH_DEFAULT_RATE,
+		.duration = BENCH_DEFAULT_DURATION,
+		.lead_ms = BENCH_DEFAULT_LEAD_MS,
+		.rt = RT_OPTIONS_INIT,
+	};
+	struct uinput_device dev;
+	const char *bench;
+	int opt, ret = -1;
+
+	while ((opt = getopt(argc, argv, "n:r:d:btug:i:e:" RT_OPTSTRING)) != -1) {
+		switch (opt) {
+		case 'n':
+			opts.nframes = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			opts.rate = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			opts.duration = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			opts.bulk = true;
+			break;
+		case 't':
+			opts.pipelined = true;
+			break;
+		case 'u':
+			opts.uring = true;
+			break;
+		case 'g':
+			opts.gpiochip = optarg;
+			break;
+		case 'i':
+			opts.i2c_file = optarg;
+			break;
+		case 'e':
+			opts.lead_ms = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			if (rt_parse_option(&opts.rt, opt, optarg)) {
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	if (optind >= argc) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	bench = argv[optind];
+
+	/* Offline, on the recorded events only. */
+	if (!strcmp(bench, "predict")) {
+		if (optind + 1 >= argc) {
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		return bench_predict(argv[optind + 1], argv + optind + 2,
+				     argc - optind - 2, opts.lead_ms) ?
+			EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	if (strcmp(bench, "read") && strcmp(bench, "rate") &&
+	    (strcmp(bench, "hold") || !opts.gpiochip)) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (opts.gpiochip && gpio_init_chip(opts.gpiochip))
+		return EXIT_FAILURE;
+
+	if (opts.i2c_file &&
+	    is31fl3728_open(&bench_matrix, opts.i2c_file, BENCH_IS31FL3728_ADDR))
+		goto out;
+
+	if (bench_create_scroller(&dev))
+		goto out;
+
+	rt_apply(&opts.rt);
+
+	if (!strcmp(bench, "read"))
+		ret = bench_read(&dev, false, opts.nframes) ||
+		      bench_read(&dev, true, opts.nframes);
+	else if (!strcmp(bench, "hold"))
+		ret = bench_hold(&dev);
+	else
+		ret = bench_rate(&dev, &opts);
+
+	uinput_destroy(&dev);
+
+out:
+	is31fl3728_close(&bench_matrix);
+	if (opts.gpiochip)
+		gpio_fini();
+
+	return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
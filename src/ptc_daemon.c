@@ -0,0 +1,596 @@
+/*
+ * Daemon serving all the PTC wings of a board.
+ *
+ * The wings are described by board description files (see board.c), all
+ * their inputs are handled by one event loop in one process, instead of
+ * running one demo per wing.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "board.h"
+#include "event_loop.h"
+#include "fanout.h"
+#include "fusion.h"
+#include "gpio_helper.h"
+#include "hotplug.h"
+#include "launcher.h"
+#include "is31fl3728.h"
+#include "ptc_qt.h"
+#include "rt.h"
+#include "stats_file.h"
+#include "state_shm.h"
+
+struct ptc_device;
+
+struct ptc_axis {
+	struct ptc_device *dev;
+	unsigned int index;
+};
+
+struct ptc_device {
+	const struct board_device *desc;
+	char name[32];
+	struct buttons *buttons;
+	struct scroller *scrollers[2];
+	struct ptc_axis axes[2];
+	/* X and Y paired, positions as last output. */
+	struct fusion *fusion;
+	unsigned int position[2];
+	/* First error of the fused outputs, stops the daemon. */
+	int output_ret;
+	struct is31fl3728 matrix;
+	struct state_shm_device *state;
+	struct fanout_record published;
+	unsigned long updates;
+};
+
+static struct board board;
+static struct ptc_device devices[BOARD_MAX_DEVICES];
+/* Prediction of the slider, wheel and 2D positions, 0 if disabled. */
+static unsigned int lead_ms;
+/* Hysteresis margin on the LED updates, negative if disabled. */
+static int margin = -1;
+/* Pairing window of the X and Y frames of the 2D devices. */
+static unsigned int window_us = FUSION_DEFAULT_WINDOW_US;
+/* Shared memory segment publishing the device states, if enabled. */
+static const char *state_name;
+static struct state_shm *state_shm;
+/* Unix socket streaming the device states, if enabled. */
+static const char *fanout_path;
+static struct fanout_server *fanout;
+/* Follows the input devices across driver reloads. */
+static struct hotplug *hotplug;
+/* Counters exported in this file, if enabled. */
+static const char *stats_path;
+static struct stats_file *stats_file;
+
+/* Positions per column and per row of the LED matrix. */
+#define MATRIX_X_BUCKET		10
+#define MATRIX_Y_BUCKET		9
+
+/* Same display as the QT2 demo: one dot per touch. */
+static int matrix_update(struct ptc_device *dev)
+{
+	unsigned int xpos = dev->position[0], ypos = dev->position[1];
+
+	is31fl3728_clear(&dev->matrix);
+
+	/* xpos: 0 to 63, ypos: 0 to 57 */
+	if (xpos && ypos)
+		is31fl3728_set_column(&dev->matrix, xpos / MATRIX_X_BUCKET,
+				      0b01000000 >> (ypos / MATRIX_Y_BUCKET));
+
+	return is31fl3728_flush(&dev->matrix);
+}
+
+/*
+ * Publish the state of a device after its events were handled, if it
+ * changed: in shared memory and to the fan-out clients.
+ */
+static void publish_state(struct ptc_device *dev)
+{
+	struct fanout_record record = { .device = dev - devices };
+	const struct scroller *scroller;
+	struct state_shm_data data;
+	unsigned long long time_us;
+	unsigned int i;
+
+	if (!dev->state && !fanout)
+		return;
+
+	if (dev->buttons) {
+		record.keys = dev->buttons->pressed;
+		record.time_us = latency_timeval_us(&dev->buttons->time);
+	}
+
+	for (i = 0; i < 2; i++) {
+		scroller = dev->scrollers[i];
+		if (!scroller)
+			continue;
+
+		if (scroller->touched)
+			record.keys |= 1;
+		record.position[i] = scroller->position;
+		time_us = latency_timeval_us(&scroller->time);
+		if (time_us > record.time_us)
+			record.time_us = time_us;
+	}
+
+	if (!memcmp(&record, &dev->published, sizeof(record)))
+		return;
+	dev->published = record;
+
+	if (dev->state) {
+		data.time_us = record.time_us;
+		data.keys = record.keys;
+		data.position[0] = record.position[0];
+		data.position[1] = record.position[1];
+		data.updates = ++dev->updates;
+		state_shm_publish(dev->state, &data);
+	}
+
+	if (fanout) {
+		fanout_queue(fanout, &record);
+		fanout_flush(fanout);
+	}
+}
+
+static int buttons_handler(int fd, uint32_t events, void *arg)
+{
+	struct ptc_device *dev = arg;
+	int ret;
+
+	ret = button_event_handler(dev->buttons);
+	publish_state(dev);
+
+	return ret;
+}
+
+static int scroller_handler(int fd, uint32_t events, void *arg)
+{
+	struct ptc_device *dev = arg;
+	int ret;
+
+	ret = scroller_event_handler(dev->scrollers[0], NULL);
+	publish_state(dev);
+
+	return ret;
+}
+
+/* One matrix update or line per X/Y sample of a 2D device. */
+static int fused_output(const struct fusion_sample *sample, void *arg)
+{
+	struct ptc_device *dev = arg;
+
+	dev->position[0] = sample->position[0];
+	dev->position[1] = sample->position[1];
+	publish_state(dev);
+
+	if (dev->desc->type == BOARD_MATRIX)
+		return matrix_update(dev);
+
+	printf("%s: x=%u - y=%u\n", dev->name, dev->position[0],
+	       dev->position[1]);
+	return 0;
+}
+
+static void axis_frame_update(struct scroller *scroller,
+			      const struct scroller_frame *frame, void *arg)
+{
+	struct ptc_axis *axis = arg;
+	struct ptc_device *dev = axis->dev;
+	unsigned int position = dev->fusion->sample.position[axis->index];
+	int ret;
+
+	scroller_position_frame_update(scroller, frame, &position);
+
+	ret = fusion_update(dev->fusion, axis->index, &frame->time,
+			    scroller->touched, position);
+	if (ret && !dev->output_ret)
+		dev->output_ret = ret;
+}
+
+static int axis_handler(int fd, uint32_t events, void *arg)
+{
+	struct ptc_axis *axis = arg;
+	struct ptc_device *dev = axis->dev;
+	int ret;
+
+	ret = scroller_event_handler(dev->scrollers[axis->index], axis);
+
+	return ret ? ret : dev->output_ret;
+}
+
+/* Name of the scroller of axis index of a device, for the statistics. */
+static void scroller_name(const struct ptc_device *dev, unsigned int index,
+			  char *name, size_t size)
+{
+	snprintf(name, size, "%s%s", dev->name,
+		 dev->scrollers[1] ? (index ? "_y" : "_x") : "");
+}
+
+static void write_counters(FILE *f, void *arg)
+{
+	struct ptc_device *dev;
+	unsigned int i, j;
+	char name[48];
+
+	for (i = 0; i < board.ndevices; i++) {
+		dev = &devices[i];
+
+		if (dev->buttons)
+			buttons_print_counters(dev->buttons, f, dev->name);
+
+		for (j = 0; j < 2; j++) {
+			if (!dev->scrollers[j])
+				continue;
+
+			scroller_name(dev, j, name, sizeof(name));
+			scroller_print_counters(dev->scrollers[j], f, name);
+		}
+
+		if (dev->matrix.fd >= 0) {
+			snprintf(name, sizeof(name), "%s_matrix", dev->name);
+			is31fl3728_print_counters(&dev->matrix, f, name);
+		}
+
+		if (dev->fusion)
+			fprintf(f, "%s_fusion frames=%lu samples=%lu pairs=%lu\n",
+				dev->name, dev->fusion->frames,
+				dev->fusion->samples, dev->fusion->paired);
+	}
+
+	if (fanout) {
+		unsigned long dropped = fanout->dropped;
+
+		for (i = 0; i < FANOUT_MAX_CLIENTS; i++)
+			if (fanout->clients[i])
+				dropped += fanout->clients[i]->dropped;
+
+		fprintf(f, "fanout states=%lu clients=%lu dropped=%lu\n",
+			fanout->records, fanout->clients_served, dropped);
+	}
+}
+
+static void dump_stats(void)
+{
+	struct ptc_device *dev;
+	unsigned int i, j;
+	char name[48];
+
+	write_counters(stderr, NULL);
+
+	for (i = 0; i < board.ndevices; i++) {
+		dev = &devices[i];
+
+		if (dev->buttons)
+			buttons_print_latency(dev->buttons, stderr, dev->name);
+
+		for (j = 0; j < 2; j++) {
+			if (!dev->scrollers[j])
+				continue;
+
+			scroller_name(dev, j, name, sizeof(name));
+			scroller_print_latency(dev->scrollers[j], stderr, name);
+			if (dev->scrollers[j]->hold)
+				fprintf(stderr, "%s: %lu positions held by hysteresis\n",
+					name, dev->scrollers[j]->hysteresis.suppressed);
+		}
+
+		if (dev->matrix.fd >= 0)
+			latency_hist_print(&dev->matrix.write_latency, stderr,
+					   dev->name, "matrix write");
+	}
+
+	if (hotplug)
+		hotplug_print_stats(hotplug, stderr);
+}
+
+static int quit_handler(int signo, void *arg)
+{
+	return 1;
+}
+
+static int stats_handler(int signo, void *arg)
+{
+	dump_stats();
+	if (stats_file)
+		stats_file_refresh(stats_file);
+	return 0;
+}
+
+static void remove_device(struct ptc_device *dev)
+{
+	unsigned int i;
+
+	if (dev->buttons)
+		remove_buttons(dev->buttons);
+
+	for (i = 0; i < 2; i++)
+		if (dev->scrollers[i])
+			remove_scroller(dev->scrollers[i]);
+
+	fusion_free(dev->fusion);
+	is31fl3728_close(&dev->matrix);
+}
+
+/* Position filtering of the scroller of axis index of a device. */
+static int setup_scroller(struct scroller *scroller,
+			  const struct board_device *desc, unsigned int index)
+{
+	bool wheel = desc->type == BOARD_WHEEL;
+	unsigned int bucket;
+
+	if (scroller_set_prediction(scroller, lead_ms, wheel))
+		return -1;
+
+	if (margin < 0)
+		return 0;
+
+	switch (desc->type) {
+	case BOARD_SLIDER:
+	case BOARD_WHEEL:
+		/* Without LEDs, nothing displayed to hold. */
+		return scroller->led_masks ?
+		       scroller_set_led_hysteresis(scroller, margin) : 0;
+	case BOARD_MATRIX:
+		bucket = index ? MATRIX_Y_BUCKET : MATRIX_X_BUCKET;
+		break;
+	default:
+		/* Positions printed as is. */
+		bucket = 1;
+		break;
+	}
+
+	return scroller_set_hysteresis(scroller, bucket, margin, wheel);
+}
+
+static int initialize_device(struct ptc_device *dev,
+			     const struct board_device *desc,
+			     struct event_loop *loop)
+{
+	const char *i2c_file;
+	unsigned int i;
+
+	switch (desc->type) {
+	case BOARD_BUTTONS:
+		dev->buttons = initialize_buttons(desc->input[0], desc->key_codes,
+						  desc->leds, desc->nleds);
+		if (!dev->buttons ||
+		    hotplug_add_buttons(hotplug, dev->buttons, desc->input[0],
+					buttons_handler, dev))
+			return -1;
+		break;
+	case BOARD_SLIDER:
+	case BOARD_WHEEL:
+		dev->scrollers[0] = initialize_scroller_frames(desc->input[0],
+			desc->leds, desc->nleds, scroller_leds_frame_update);
+		if (!dev->scrollers[0] ||
+		    scroller_set_led_map(dev->scrollers[0],
+					 desc->type == BOARD_SLIDER ?
+					 SCROLLER_LED_BAR : SCROLLER_LED_WHEEL) ||
+		    setup_scroller(dev->scrollers[0], desc, 0) ||
+		    hotplug_add_scroller(hotplug, dev->scrollers[0], desc->input[0],
+					 scroller_handler, dev))
+			return -1;
+		break;
+	case BOARD_MATRIX:
+		/* PTC_I2C_DEVICE can point the matrix to another bus, e.g. i2c-stub. */
+		i2c_file = getenv("PTC_I2C_DEVICE");
+		if (!i2c_file)
+			i2c_file = desc->i2c_file;
+
+		if (is31fl3728_open(&dev->matrix, i2c_file, desc->i2c_addr))
+			return -1;
+		/* fall through */
+	case BOARD_POSITION:
+		dev->fusion = fusion_new(loop, window_us, fused_output, dev);
+		if (!dev->fusion)
+			return -1;
+
+		for (i = 0; i < 2; i++) {
+			dev->axes[i].dev = dev;
+			dev->axes[i].index = i;
+			dev->scrollers[i] = initialize_scroller_frames(desc->input[i],
+				NULL, 0, axis_frame_update);
+			if (!dev->scrollers[i] ||
+			    setup_scroller(dev->scrollers[i], desc, i) ||
+			    hotplug_add_scroller(hotplug, dev->scrollers[i],
+						 desc->input[i], axis_handler,
+						 &dev->axes[i]))
+				return -1;
+		}
+		break;
+	}
+
+	return 0;
+}
+
+static bool board_has_leds(const struct board *board)
+{
+	unsigned int i;
+
+	for (i = 0; i < board->ndevices; i++)
+		if (board->devices[i].nleds)
+			return true;
+
+	return false;
+}
+
+/* Input files of all the devices, for the launcher to wait for. */
+static unsigned int board_input_files(const struct board *board,
+				      const char **files)
+{
+	unsigned int i, n = 0;
+
+	for (i = 0; i < board->ndevices; i++) {
+		files[n++] = board->devices[i].input[0];
+		if (board->devices[i].type == BOARD_MATRIX ||
+		    board->devices[i].type == BOARD_POSITION)
+			files[n++] = board->devices[i].input[1];
+	}
+
+	return n;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [options] board-file...\noptions:\n"
+		"  -e ms       display the touch position this far ahead (prediction)\n"
+		"  -m margin   only update the LEDs past this margin (hysteresis)\n"
+		FUSION_USAGE
+		"  -s name     publish the device states in this shared memory\n"
+		"              segment, e.g. " STATE_SHM_DEFAULT_NAME "\n"
+		"  -f path     stream the device states to the clients of this\n"
+		"              Unix socket\n"
+		STATS_FILE_USAGE LAUNCHER_USAGE RT_USAGE, prog);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int i, n = 0, counts[BOARD_POSITION + 1] = { 0 };
+	const char *input_files[BOARD_MAX_DEVICES * 2];
+	struct launcher launcher = LAUNCHER_INIT;
+	struct rt_options rt = RT_OPTIONS_INIT;
+	struct event_loop *loop = NULL;
+	bool gpio = false;
+	int opt, ret = -1;
+
+	while ((opt = getopt(argc, argv, "e:m:w:s:f:o:" LAUNCHER_OPTSTRING RT_OPTSTRING)) != -1) {
+		if (opt == 'e') {
+			lead_ms = strtoul(optarg, NULL, 0);
+		} else if (opt == 'm') {
+			margin = strtol(optarg, NULL, 0);
+		} else if (opt == 'w') {
+			window_us = strtoul(optarg, NULL, 0);
+		} else if (opt == 's') {
+			state_name = optarg;
+		} else if (opt == 'f') {
+			fanout_path = optarg;
+		} else if (opt == 'o') {
+			stats_path = optarg;
+		} else if (opt == 'l') {
+			launcher.config = optarg;
+		} else if (rt_parse_option(&rt, opt, optarg)) {
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind >= argc) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	for (i = optind; i < (unsigned int)argc; i++)
+		if (board_load(&board, argv[i]))
+			return EXIT_FAILURE;
+
+	if (launcher_start(&launcher, input_files,
+			   board_input_files(&board, input_files)))
+		return EXIT_FAILURE;
+
+	if (board_has_leds(&board)) {
+		/* PTC_GPIOCHIP, if set, takes precedence over the board file. */
+		if (board.gpiochip[0] && !getenv("PTC_GPIOCHIP")) {
+			if (gpio_init_chip(board.gpiochip))
+				return EXIT_FAILURE;
+		} else if (gpio_init()) {
+			return EXIT_FAILURE;
+		}
+		gpio = true;
+	}
+
+	loop = event_loop_new();
+	if (!loop)
+		goto out;
+
+	hotplug = hotplug_new(loop);
+	if (!hotplug)
+		goto out;
+
+	for (n = 0; n < board.ndevices; n++) {
+		const struct board_device *desc = &board.devices[n];
+
+		devices[n].desc = desc;
+		devices[n].matrix.fd = -1;
+		snprintf(devices[n].name, sizeof(devices[n].name), "%s%u",
+			 board_device_type_name(desc->type), counts[desc->type]++);
+
+		if (initialize_device(&devices[n], desc, loop)) {
+			n++;
+			goto out;
+		}
+	}
+
+	if (fanout_path) {
+		fanout = fanout_start(loop, fanout_path);
+		if (!fanout)
+			goto out;
+
+		for (i = 0; i < board.ndevices; i++)
+			fanout_add_device(fanout, devices[i].name,
+					  board_device_type_name(devices[i].desc->type));
+	}
+
+	if (state_name) {
+		state_shm = state_shm_create(state_name, board.ndevices);
+		if (!state_shm)
+			goto out;
+
+		for (i = 0; i < state_shm->ndevices; i++) {
+			snprintf(state_shm->devices[i].name,
+				 sizeof(state_shm->devices[i].name), "%s",
+				 devices[i].name);
+			snprintf(state_shm->devices[i].type,
+				 sizeof(state_shm->devices[i].type), "%s",
+				 board_device_type_name(devices[i].desc->type));
+			devices[i].state = &state_shm->devices[i];
+		}
+	}
+
+	if (stats_path) {
+		stats_file = stats_file_start(loop, stats_path, STATS_FILE_PERIOD_MS,
+					      write_counters, NULL);
+		if (!stats_file)
+			goto out;
+	}
+
+	if (!event_loop_add_signal(loop, SIGINT, 0, quit_handler, NULL) ||
+	    !event_loop_add_signal(loop, SIGTERM, 0, quit_handler, NULL) ||
+	    !event_loop_add_signal(loop, SIGUSR1, 0, stats_handler, NULL))
+		goto out;
+
+	/* Reported, but not fatal: the daemon still works, with more jitter. */
+	rt_apply(&rt);
+
+	launcher_ready(&launcher);
+
+	printf("daemon running, %u devices...\n", board.ndevices);
+	ret = event_loop_run(loop);
+	if (ret < 0)
+		fprintf(stderr, "event error\n");
+
+	dump_stats();
+
+out:
+	fanout_stop(fanout);
+	state_shm_destroy(state_shm, state_name);
+	stats_file_stop(stats_file);
+	hotplug_free(hotplug);
+	/* The fusion timers are sources of the loop. */
+	for (i = 0; i < n; i++)
+		remove_device(&devices[i]);
+	event_loop_free(loop);
+	if (gpio)
+		gpio_fini();
+
+	return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
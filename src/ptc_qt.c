@@ -23,14 +23,272 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/time.h>
 
 #include <libevdev-1.0/libevdev/libevdev.h>
 
 #include "ptc_qt.h"
 #include "gpio_helper.h"
 
-int scroller_event_handler(struct scroller *scroller, void *arg)
+static void scroller_frame_reset(struct scroller *scroller)
+{
+	memset(&scroller->frame, 0, sizeof(scroller->frame));
+	scroller->frame.events = scroller->events;
+}
+
+static void scroller_frame_predict(struct scroller *scroller,
+				   struct scroller_frame *frame)
+{
+	if (frame->resync || (frame->has_key && !frame->key_value))
+		predictor_reset(&scroller->predictor);
+
+	if (frame->has_abs && (!frame->has_key || frame->key_value))
+		frame->abs_value = predictor_update(&scroller->predictor,
+						    frame->abs_value,
+						    latency_timeval_us(&frame->time));
+}
+
+/*
+ * First position and number of positions lighting the same LEDs as index,
+ * the LED table steps being as long as the rounding of the range makes
+ * them.
+ */
+static void scroller_led_step(const struct scroller *scroller, int index,
+			      int *start, unsigned int *size)
+{
+	unsigned int mask;
+	int end;
+
+	if (index < 0)
+		index = 0;
+	else if (index >= (int)scroller->led_range)
+		index = scroller->led_range - 1;
+
+	mask = scroller->led_masks[index];
+	for (*start = index; *start > 0; (*start)--)
+		if (scroller->led_masks[*start - 1] != mask)
+			break;
+	for (end = index + 1; end < (int)scroller->led_range; end++)
+		if (scroller->led_masks[end] != mask)
+			break;
+	*size = end - *start;
+}
+
+/*
+ * Whether a frame only moves the position within the margins of the step
+ * last displayed: a finger resting on the slider makes it dither by one.
+ * Touches, releases and resyncs always go through.
+ */
+static bool scroller_frame_hold(struct scroller *scroller,
+				const struct scroller_frame *frame)
+{
+	struct scroller_hysteresis *h = &scroller->hysteresis;
+	int offset, value;
+
+	if (frame->resync || frame->has_key)
+		h->valid = false;
+
+	if (!frame->has_abs || (frame->has_key && !frame->key_value))
+		return false;
+
+	value = frame->abs_value - h->min;
+	if (h->valid) {
+		offset = value - h->start;
+		if (h->wrap) {
+			offset %= h->range;
+			if (offset >= h->range / 2)
+				offset -= h->range;
+			else if (offset < -h->range / 2)
+				offset += h->range;
+		}
+
+		if (offset >= -(int)h->margin &&
+		    offset < (int)(h->size + h->margin)) {
+			h->suppressed++;
+			return true;
+		}
+	}
+
+	if (h->leds) {
+		scroller_led_step(scroller, value, &h->start, &h->size);
+	} else {
+		h->start = value / (int)h->bucket * (int)h->bucket;
+		h->size = h->bucket;
+	}
+	h->valid = true;
+
+	return false;
+}
+
+/* Predict, hold within the hysteresis, then update and record latencies. */
+static void scroller_frame_deliver(struct scroller *scroller, void *arg)
+{
+	struct scroller_frame *frame = &scroller->frame;
+	unsigned long long event_us, read_us, done_us;
+
+	counter_inc(&scroller->frames);
+
+	if (scroller->predict)
+		scroller_frame_predict(scroller, frame);
+
+	if (scroller->hold && scroller_frame_hold(scroller, frame))
+		return;
+
+	if (frame->has_key)
+		scroller->touched = frame->key_value;
+	else if (frame->has_abs && scroller->key_code < 0)
+		scroller->touched = true;
+	if (frame->has_abs)
+		scroller->position = frame->abs_value;
+	scroller->time = frame->time;
+
+	if (!scroller->latency) {
+		scroller->frame_update(scroller, frame, arg);
+		return;
+	}
+
+	event_us = latency_timeval_us(&frame->time);
+	read_us = latency_now_us();
+	scroller->frame_update(scroller, frame, arg);
+	done_us = latency_now_us();
+
+	if (read_us < event_us)
+		read_us = event_us;
+	latency_hist_add(&scroller->read_latency, read_us - event_us);
+	latency_hist_add(&scroller->callback_latency, done_us - read_us);
+	latency_hist_add(&scroller->total_latency, done_us - event_us);
+}
+
+static void scroller_frame_reduce(struct scroller_frame *frame,
+				  const struct input_event *ev)
+{
+	switch (ev->type) {
+	case EV_ABS:
+		frame->has_abs = true;
+		frame->abs_value = ev->value;
+		break;
+	case EV_KEY:
+		frame->has_key = true;
+		frame->key_value = ev->value;
+		break;
+	}
+}
+
+/*
+ * Accumulate events until SYN_REPORT, then hand the whole frame to the
+ * frame_update callback at once: intermediate values overwritten within the
+ * same report never reach the callback.
+ */
+static void scroller_frame_event(struct scroller *scroller,
+				 const struct input_event *ev, void *arg)
+{
+	struct scroller_frame *frame = &scroller->frame;
+
+	if (ev->type == EV_SYN) {
+		if (ev->code != SYN_REPORT)
+			return;
+
+		if (frame->nevents) {
+			frame->time = ev->time;
+			scroller_frame_deliver(scroller, arg);
+		}
+		scroller_frame_reset(scroller);
+		return;
+	}
+
+	scroller_frame_reduce(frame, ev);
+
+	/* Past the buffer size, only the reduced state is kept. */
+	if (frame->nevents < SCROLLER_MAX_FRAME_EVENTS)
+		scroller->events[frame->nevents++] = *ev;
+}
+
+/* Current time, from the clock used for the event timestamps. */
+static void scroller_frame_time_now(const struct scroller *scroller,
+				    struct timeval *tv)
+{
+	unsigned long long us;
+
+	if (!scroller->latency) {
+		gettimeofday(tv, NULL);
+		return;
+	}
+
+	us = latency_now_us();
+	tv->tv_sec = us / 1000000;
+	tv->tv_usec = us % 1000000;
+}
+
+/*
+ * The kernel buffer overflowed (SYN_DROPPED): drain the delta events
+ * libevdev generates from the current device state, then report that state
+ * as a single update instead of the partial frame that was being built.
+ * force is used in bulk read mode where libevdev did not see the overflow.
+ */
+static int scroller_resync(struct scroller *scroller, bool force, void *arg)
+{
+	struct scroller_frame *frame = &scroller->frame;
+	struct input_event ev;
+	int ret;
+
+	counter_inc(&scroller->sync_dropped);
+
+	if (force)
+		libevdev_next_event(scroller->evdev,
+				    LIBEVDEV_READ_FLAG_FORCE_SYNC, &ev);
+
+	do {
+		ret = libevdev_next_event(scroller->evdev,
+					  LIBEVDEV_READ_FLAG_SYNC, &ev);
+		if (ret == LIBEVDEV_READ_STATUS_SYNC)
+			counter_inc(&scroller->sync_events);
+	} while (ret == LIBEVDEV_READ_STATUS_SYNC);
+
+	if (ret != -EAGAIN) {
+		fprintf(stderr, "error: %s\n", strerror(-ret));
+		counter_inc(&scroller->errors);
+		return ret == -ENODEV ? ret : -1;
+	}
+
+	fprintf(stderr, "warning: %s: events dropped, state resynchronized\n",
+		libevdev_get_name(scroller->evdev));
+
+	scroller_frame_reset(scroller);
+	frame->resync = true;
+
+	if (scroller->key_code >= 0) {
+		frame->has_key = true;
+		frame->key_value = libevdev_get_event_value(scroller->evdev,
+							   EV_KEY, scroller->key_code);
+	}
+
+	/* The position is only meaningful while touched. */
+	if (scroller->abs_code >= 0 && (!frame->has_key || frame->key_value)) {
+		frame->has_abs = true;
+		frame->abs_value = libevdev_get_event_value(scroller->evdev,
+							   EV_ABS, scroller->abs_code);
+	}
+
+	if (scroller->frame_update) {
+		scroller_frame_time_now(scroller, &frame->time);
+		scroller_frame_deliver(scroller, arg);
+	} else {
+		if (frame->has_abs)
+			scroller->position_update(&scroller->bank, EV_ABS,
+						  frame->abs_value, arg);
+		if (frame->has_key)
+			scroller->position_update(&scroller->bank, EV_KEY,
+						  frame->key_value, arg);
+	}
+
+	scroller_frame_reset(scroller);
+
+	return 0;
+}
+
+static int scroller_evdev_event_handler(struct scroller *scroller, void *arg)
 {
 	struct input_event ev;
 	int ret;
@@ -39,57 +297,356 @@ int scroller_event_handler(struct scroller *scroller, void *arg)
 		ret = libevdev_next_event(scroller->evdev,
 					  LIBEVDEV_READ_FLAG_NORMAL, &ev);
 		if (ret == LIBEVDEV_READ_STATUS_SYNC) {
-			fprintf(stderr, "error: cannot keep up\n");
-			return -1;
+			ret = scroller_resync(scroller, false, arg);
+			if (ret)
+				return ret;
 		} else if (ret != -EAGAIN && ret < 0) {
 			fprintf(stderr, "error: %s\n", strerror(-ret));
-			return -1;
+			counter_inc(&scroller->errors);
+			return ret == -ENODEV ? ret : -1;
 		} else	if (ret == LIBEVDEV_READ_STATUS_SUCCESS) {
-			scroller->position_update(scroller->leds,
-				scroller->nleds, ev.type, ev.value, arg);
+			counter_inc(&scroller->events_read);
+			if (scroller->frame_update)
+				scroller_frame_event(scroller, &ev, arg);
+			else
+				scroller->position_update(&scroller->bank,
+					ev.type, ev.value, arg);
 		}
 	} while (ret != -EAGAIN);
 
 	return 0;
 }
 
-void remove_scroller(struct scroller *scroller)
+/*
+ * Bulk read mode: read() as many events as the buffer can hold and process
+ * them in place, frames are handed to frame_update as slices of the buffer.
+ * The events of a frame not complete yet are moved to the start of the
+ * buffer for the next read.
+ *
+ * The read itself can be done by the caller, e.g. through io_uring:
+ * scroller_bulk_buffer() returns where the next read has to land and
+ * scroller_bulk_complete() processes what it returned.
+ */
+void *scroller_bulk_buffer(struct scroller *scroller, size_t *size)
+{
+	/* A frame filling the whole buffer only keeps its reduced state. */
+	if (scroller->bulk_count == SCROLLER_BULK_EVENTS)
+		scroller->bulk_count = 0;
+
+	*size = (SCROLLER_BULK_EVENTS - scroller->bulk_count) *
+		sizeof(*scroller->bulk_events);
+	return scroller->bulk_events + scroller->bulk_count;
+}
+
+int scroller_bulk_complete(struct scroller *scroller, ssize_t len, void *arg)
+{
+	struct scroller_frame *frame = &scroller->frame;
+	struct input_event *events = scroller->bulk_events;
+	unsigned int i, start, end;
+	int ret;
+
+	if (len <= 0) {
+		fprintf(stderr, "error: %s\n", len ? strerror(-len) : "end of file");
+		counter_inc(&scroller->errors);
+		return len == -ENODEV ? -ENODEV : -1;
+	}
+
+	counter_add(&scroller->events_read, len / sizeof(*events));
+
+	start = 0;
+	end = scroller->bulk_count + len / sizeof(*events);
+	for (i = scroller->bulk_count; i < end; i++) {
+		if (events[i].type != EV_SYN) {
+			scroller_frame_reduce(frame, &events[i]);
+			continue;
+		}
+
+		if (events[i].code == SYN_DROPPED) {
+			/* What is left in the buffer is outdated. */
+			scroller->bulk_count = 0;
+			scroller_frame_reset(scroller);
+			ret = scroller_resync(scroller, true, arg);
+			/*
+			 * libevdev read the device to sync: the events it
+			 * queued go first, bulk reads resume after.
+			 */
+			return ret ? ret : scroller_evdev_event_handler(scroller, arg);
+		}
+
+		if (events[i].code != SYN_REPORT)
+			continue;
+
+		frame->events = events + start;
+		frame->nevents = i - start;
+		if (frame->nevents) {
+			frame->time = events[i].time;
+			scroller_frame_deliver(scroller, arg);
+		}
+		scroller_frame_reset(scroller);
+		start = i + 1;
+	}
+
+	scroller->bulk_count = end - start;
+	if (start && scroller->bulk_count)
+		memmove(events, events + start,
+			scroller->bulk_count * sizeof(*events));
+
+	return 0;
+}
+
+static int scroller_bulk_event_handler(struct scroller *scroller, void *arg)
+{
+	ssize_t len;
+	size_t size;
+	void *buf;
+	int ret;
+
+	for (;;) {
+		buf = scroller_bulk_buffer(scroller, &size);
+		len = read(scroller->fd, buf, size);
+		if (len < 0 && errno == EAGAIN)
+			return 0;
+
+		ret = scroller_bulk_complete(scroller, len < 0 ? -errno : len, arg);
+		if (ret)
+			return ret;
+	}
+}
+
+int scroller_event_handler(struct scroller *scroller, void *arg)
+{
+	if (scroller->bulk_events)
+		return scroller_bulk_event_handler(scroller, arg);
+
+	return scroller_evdev_event_handler(scroller, arg);
+}
+
+/*
+ * Switch a frame based scroller between reading events through libevdev,
+ * the default, and reading them in bulk straight from the device.
+ * libevdev is then only used to resynchronize after SYN_DROPPED.
+ */
+int scroller_set_bulk_read(struct scroller *scroller, bool enable)
+{
+	if (!enable) {
+		free(scroller->bulk_events);
+		scroller->bulk_events = NULL;
+		return 0;
+	}
+
+	if (!scroller->frame_update) {
+		fprintf(stderr, "bulk read needs a frame based scroller\n");
+		return -1;
+	}
+
+	if (scroller->bulk_events)
+		return 0;
+
+	scroller->bulk_events = malloc(SCROLLER_BULK_EVENTS * sizeof(struct input_event));
+	if (!scroller->bulk_events) {
+		fprintf(stderr, "Can't allocate bulk read buffer\n");
+		return -1;
+	}
+	scroller->bulk_count = 0;
+
+	return 0;
+}
+
+/*
+ * Display the position lead_ms ahead of the reported one, extrapolated from
+ * the speed of the finger, 0 to display it as reported. wrap is for wheels.
+ */
+int scroller_set_prediction(struct scroller *scroller, unsigned int lead_ms,
+			    bool wrap)
+{
+	const struct input_absinfo *info;
+
+	if (!lead_ms) {
+		scroller->predict = false;
+		return 0;
+	}
+
+	if (!scroller->frame_update || scroller->abs_code < 0) {
+		fprintf(stderr, "prediction needs a frame based scroller with a position\n");
+		return -1;
+	}
+
+	info = libevdev_get_abs_info(scroller->evdev, scroller->abs_code);
+	if (!info) {
+		fprintf(stderr, "no range for the scroller position\n");
+		return -1;
+	}
+
+	predictor_init(&scroller->predictor, info->minimum, info->maximum, wrap,
+		       lead_ms);
+	scroller->predict = true;
+
+	return 0;
+}
+
+/*
+ * Only forward positions moving to another bucket of bucket positions, i.e.
+ * changing the LEDs, and by more than margin past its boundary. bucket 0
+ * disables it. wrap is for wheels.
+ */
+int scroller_set_hysteresis(struct scroller *scroller, unsigned int bucket,
+			    unsigned int margin, bool wrap)
+{
+	struct scroller_hysteresis *h = &scroller->hysteresis;
+	const struct input_absinfo *info;
+
+	if (!bucket) {
+		scroller->hold = false;
+		return 0;
+	}
+
+	if (!scroller->frame_update || scroller->abs_code < 0) {
+		fprintf(stderr, "hysteresis needs a frame based scroller with a position\n");
+		return -1;
+	}
+
+	info = libevdev_get_abs_info(scroller->evdev, scroller->abs_code);
+	if (!info) {
+		fprintf(stderr, "no range for the scroller position\n");
+		return -1;
+	}
+
+	memset(h, 0, sizeof(*h));
+	h->bucket = bucket;
+	h->margin = margin;
+	h->wrap = wrap;
+	h->min = info->minimum;
+	h->range = info->maximum >= info->minimum ?
+		   info->maximum - info->minimum + 1 : 1;
+	scroller->hold = true;
+
+	return 0;
+}
+
+/*
+ * Same on the LED table set by scroller_set_led_map(): positions are only
+ * forwarded when they light other LEDs, and by more than margin past the
+ * positions of the LEDs displayed.
+ */
+int scroller_set_led_hysteresis(struct scroller *scroller, unsigned int margin)
 {
-	unsigned int i;
+	struct scroller_hysteresis *h = &scroller->hysteresis;
 
-	for (i = 0; i < scroller->nleds; i++)
-			gpio_led_release(&scroller->leds[i]);
+	if (!scroller->led_masks) {
+		fprintf(stderr, "hysteresis needs the LED map of the scroller\n");
+		return -1;
+	}
+
+	memset(h, 0, sizeof(*h));
+	h->leds = true;
+	h->margin = margin;
+	h->wrap = scroller->led_wheel;
+	h->min = scroller->led_min;
+	h->range = scroller->led_range;
+	scroller->hold = true;
+
+	return 0;
+}
+
+void scroller_print_latency(const struct scroller *scroller, FILE *f,
+			    const char *name)
+{
+	latency_hist_print(&scroller->read_latency, f, name, "read");
+	latency_hist_print(&scroller->callback_latency, f, name, "callback");
+	if (scroller->bank.nleds)
+		latency_hist_print(&scroller->bank.write_latency, f, name, "write");
+	latency_hist_print(&scroller->total_latency, f, name, "total");
+}
+
+void buttons_print_latency(const struct buttons *buttons, FILE *f,
+			   const char *name)
+{
+	latency_hist_print(&buttons->read_latency, f, name, "read");
+	latency_hist_print(&buttons->bank.write_latency, f, name, "write");
+	latency_hist_print(&buttons->total_latency, f, name, "total");
+}
+
+/*
+ * One line per device, "name key=value...", read with relaxed loads: cheap
+ * enough to be exported periodically while the device is in use.
+ */
+static void print_counters(FILE *f, const char *name,
+			   const atomic_ulong *events, const atomic_ulong *frames,
+			   const atomic_ulong *sync_dropped,
+			   const atomic_ulong *errors,
+			   const struct gpio_led_bank *bank)
+{
+	fprintf(f, "%s events=%lu frames=%lu sync_dropped=%lu errors=%lu "
+		"led_writes=%lu led_skipped=%lu led_errors=%lu\n", name,
+		counter_read(events), counter_read(frames),
+		counter_read(sync_dropped), counter_read(errors),
+		counter_read(&bank->writes), counter_read(&bank->skipped),
+		counter_read(&bank->errors));
+}
+
+void scroller_print_counters(const struct scroller *scroller, FILE *f,
+			     const char *name)
+{
+	print_counters(f, name, &scroller->events_read, &scroller->frames,
+		       &scroller->sync_dropped, &scroller->errors, &scroller->bank);
+}
+
+void buttons_print_counters(const struct buttons *buttons, FILE *f,
+			    const char *name)
+{
+	print_counters(f, name, &buttons->events_read, &buttons->frames,
+		       &buttons->sync_dropped, &buttons->errors, &buttons->bank);
+}
+
+static int scroller_build_led_masks(struct scroller *scroller, bool wheel);
 
+/*
+ * Close the input device of a scroller, e.g. when the driver is unloaded,
+ * keeping everything else: its LEDs and their state, callbacks and
+ * settings. scroller_attach() opens it again.
+ */
+void scroller_detach(struct scroller *scroller)
+{
 	if (scroller->evdev)
 		libevdev_free(scroller->evdev);
+	scroller->evdev = NULL;
 
-	if (scroller->fd > 0)
+	if (scroller->fd >= 0)
 		close(scroller->fd);
+	scroller->fd = -1;
+
+	scroller_frame_reset(scroller);
+	scroller->bulk_count = 0;
+	predictor_reset(&scroller->predictor);
+	scroller->hysteresis.valid = false;
+}
+
+void remove_scroller(struct scroller *scroller)
+{
+	scroller_detach(scroller);
+
+	free(scroller->bulk_events);
+	free(scroller->led_masks);
+
+	gpio_led_bank_release(&scroller->bank);
 
 	free(scroller);
 }
 
-struct scroller *initialize_scroller(const char *input_file,
-	struct gpio_led_desc *leds, unsigned int nleds,
-	void (*position_update)(struct gpio_led_desc *leds,
-				unsigned int nleds,
-				unsigned int ev_type,
-				unsigned int ev_value,
-				void *arg))
+static int scroller_first_code(struct libevdev *evdev, unsigned int type,
+				unsigned int count)
 {
-	struct scroller *scroller;
-	unsigned int i;
+	unsigned int code;
 
-	scroller = malloc(sizeof(*scroller));
-	if (!scroller) {
-		fprintf(stderr, "Can't allocate scroller\n");
-		return NULL;
-	}
+	for (code = 0; code < count; code++)
+		if (libevdev_has_event_code(evdev, type, code))
+			return code;
 
-	scroller->leds = leds;
-	scroller->nleds = nleds;
-	scroller->position_update = position_update;
+	return -1;
+}
 
+int scroller_attach(struct scroller *scroller, const char *input_file)
+{
 	scroller->fd = open(input_file, O_RDONLY | O_NONBLOCK);
 	if (scroller->fd < 0) {
 		fprintf(stderr, "Can't open %s\n", input_file);
@@ -106,12 +663,48 @@ struct scroller *initialize_scroller(const char *input_file,
 		goto out;
 	}
 
-	for (i = 0; i < nleds; i++) {
-		if (gpio_led_request(&scroller->leds[i])) {
-			fprintf(stderr,
-				"can't get gpio line for button %d led\n", i);
-			goto out;
-		}
+	/* Timestamp events with the clock used to measure latencies. */
+	if (libevdev_set_clock_id(scroller->evdev, CLOCK_MONOTONIC))
+		fprintf(stderr, "%s: can't use CLOCK_MONOTONIC timestamps, latency not recorded\n",
+			input_file);
+	else
+		scroller->latency = true;
+
+	scroller->abs_code = scroller_first_code(scroller->evdev, EV_ABS, ABS_CNT);
+	scroller->key_code = scroller_first_code(scroller->evdev, EV_KEY, KEY_CNT);
+
+	/* The position range may have changed with the driver configuration. */
+	if (scroller->led_masks &&
+	    scroller_build_led_masks(scroller, scroller->led_wheel))
+		goto out;
+
+	return 0;
+
+out:
+	scroller_detach(scroller);
+	return -1;
+}
+
+static struct scroller *scroller_new(const char *input_file,
+	const struct gpio_led_desc *leds, unsigned int nleds)
+{
+	struct scroller *scroller;
+
+	scroller = calloc(1, sizeof(*scroller));
+	if (!scroller) {
+		fprintf(stderr, "Can't allocate scroller\n");
+		return NULL;
+	}
+
+	scroller->fd = -1;
+	scroller_frame_reset(scroller);
+
+	if (scroller_attach(scroller, input_file))
+		goto out;
+
+	if (gpio_led_bank_request(&scroller->bank, leds, nleds)) {
+		fprintf(stderr, "can't get gpio lines for %s leds\n", input_file);
+		goto out;
 	}
 
 	return scroller;
@@ -120,3 +713,354 @@ out:
 	remove_scroller(scroller);
 	return NULL;
 }
+
+struct scroller *initialize_scroller(const char *input_file,
+	const struct gpio_led_desc *leds, unsigned int nleds,
+	void (*position_update)(struct gpio_led_bank *bank,
+				unsigned int ev_type,
+				unsigned int ev_value,
+				void *arg))
+{
+	struct scroller *scroller;
+
+	scroller = scroller_new(input_file, leds, nleds);
+	if (scroller)
+		scroller->position_update = position_update;
+
+	return scroller;
+}
+
+/*
+ * Precompute the LEDs of each position, so that the frame callbacks only
+ * look them up: steps LEDs patterns evenly spread over the position range.
+ */
+static int scroller_build_led_masks(struct scroller *scroller, bool wheel)
+{
+	const struct input_absinfo *info;
+	unsigned int steps, step, i;
+
+	if (!scroller->bank.nleds || scroller->abs_code < 0)
+		return 0;
+
+	info = libevdev_get_abs_info(scroller->evdev, scroller->abs_code);
+	if (!info || info->maximum < info->minimum) {
+		fprintf(stderr, "no range for the scroller position\n");
+		return -1;
+	}
+
+	free(scroller->led_masks);
+	scroller->led_wheel = wheel;
+	scroller->led_min = info->minimum;
+	scroller->led_range = info->maximum - info->minimum + 1;
+	scroller->led_masks = malloc(scroller->led_range * sizeof(*scroller->led_masks));
+	if (!scroller->led_masks) {
+		fprintf(stderr, "Can't allocate scroller LED table\n");
+		return -1;
+	}
+
+	steps = wheel ? (1u << scroller->bank.nleds) - 1 : scroller->bank.nleds;
+	for (i = 0; i < scroller->led_range; i++) {
+		step = (unsigned long long)i * steps / scroller->led_range;
+		scroller->led_masks[i] = wheel ? step + 1 : (2u << step) - 1;
+	}
+
+	if (scroller->hysteresis.leds) {
+		scroller->hysteresis.min = scroller->led_min;
+		scroller->hysteresis.range = scroller->led_range;
+		scroller->hysteresis.valid = false;
+	}
+
+	return 0;
+}
+
+struct scroller *initialize_scroller_frames(const char *input_file,
+	const struct gpio_led_desc *leds, unsigned int nleds,
+	void (*frame_update)(struct scroller *scroller,
+			     const struct scroller_frame *frame, void *arg))
+{
+	struct scroller *scroller;
+
+	scroller = scroller_new(input_file, leds, nleds);
+	if (scroller)
+		scroller->frame_update = frame_update;
+
+	return scroller;
+}
+
+/* LEDs displayed by scroller_leds_frame_update(). */
+int scroller_set_led_map(struct scroller *scroller, enum scroller_led_map map)
+{
+	/* Step numbers up to 2^nleds - 1. */
+	if (map == SCROLLER_LED_WHEEL && scroller->bank.nleds > 31) {
+		fprintf(stderr, "a wheel can't display more than 31 LEDs\n");
+		return -1;
+	}
+
+	return scroller_build_led_masks(scroller, map == SCROLLER_LED_WHEEL);
+}
+
+/* The LEDs of all the buttons changed since the last flush, in one write. */
+static void buttons_flush_leds(struct buttons *buttons)
+{
+	unsigned long long event_us, read_us;
+
+	if (!buttons->led_dirty)
+		return;
+
+	if (!buttons->latency) {
+		gpio_led_bank_update(&buttons->bank, buttons->led_dirty,
+				     buttons->pressed);
+		buttons->led_dirty = 0;
+		return;
+	}
+
+	event_us = latency_timeval_us(&buttons->time);
+	read_us = latency_now_us();
+	gpio_led_bank_update(&buttons->bank, buttons->led_dirty, buttons->pressed);
+	buttons->led_dirty = 0;
+
+	if (read_us < event_us)
+		read_us = event_us;
+	latency_hist_add(&buttons->read_latency, read_us - event_us);
+	latency_hist_add(&buttons->total_latency, latency_now_us() - event_us);
+}
+
+static void button_event(struct buttons *buttons, const struct input_event *ev)
+{
+	unsigned int index = ev->code - buttons->key_min;
+	unsigned int mask;
+
+	if (ev->type == EV_SYN && ev->code == SYN_REPORT) {
+		counter_inc(&buttons->frames);
+		buttons_flush_leds(buttons);
+		return;
+	}
+
+	if (ev->type != EV_KEY || index >= buttons->key_range)
+		return;
+
+	mask = buttons->key_masks[index];
+	if (!mask)
+		return;
+
+	buttons->pressed = ev->value ? buttons->pressed | mask :
+				       buttons->pressed & ~mask;
+	buttons->time = ev->time;
+	buttons->led_dirty |= mask;
+}
+
+int button_event_handler(struct buttons *buttons)
+{
+	unsigned int flags = LIBEVDEV_READ_FLAG_NORMAL;
+	struct input_event ev;
+	int ret;
+
+	do {
+		ret = libevdev_next_event(buttons->evdev, flags, &ev);
+		if (ret == LIBEVDEV_READ_STATUS_SYNC) {
+			/*
+			 * Events were dropped, libevdev now returns the
+			 * changes bringing the buttons to their current state.
+			 */
+			if (flags == LIBEVDEV_READ_FLAG_NORMAL) {
+				counter_inc(&buttons->sync_dropped);
+				flags = LIBEVDEV_READ_FLAG_SYNC;
+			} else {
+				counter_inc(&buttons->sync_events);
+				button_event(buttons, &ev);
+			}
+		} else if (ret == -EAGAIN && flags == LIBEVDEV_READ_FLAG_SYNC) {
+			fprintf(stderr, "warning: buttons events dropped, state resynchronized\n");
+			flags = LIBEVDEV_READ_FLAG_NORMAL;
+			ret = 0;
+		} else if (ret != -EAGAIN && ret < 0) {
+			fprintf(stderr, "error: %s\n", strerror(-ret));
+			counter_inc(&buttons->errors);
+			return ret == -ENODEV ? ret : -1;
+		} else	if (ret == LIBEVDEV_READ_STATUS_SUCCESS) {
+			counter_inc(&buttons->events_read);
+			button_event(buttons, &ev);
+		}
+	} while (ret != -EAGAIN);
+
+	/* A frame may end in the next read, its LEDs are not held back. */
+	buttons_flush_leds(buttons);
+
+	return 0;
+}
+
+/* Same as scroller_detach(), for buttons. */
+void buttons_detach(struct buttons *buttons)
+{
+	if (buttons->evdev)
+		libevdev_free(buttons->evdev);
+	buttons->evdev = NULL;
+
+	if (buttons->fd >= 0)
+		close(buttons->fd);
+	buttons->fd = -1;
+}
+
+void remove_buttons(struct buttons *buttons)
+{
+	buttons_detach(buttons);
+
+	free(buttons->key_masks);
+	gpio_led_bank_release(&buttons->bank);
+
+	free(buttons);
+}
+
+/*
+ * Direct key code to buttons table, over the range of the key codes that
+ * the device reports. Rebuilt on attach: the driver configuration may have
+ * changed the keys.
+ */
+static int buttons_build_key_masks(struct buttons *buttons,
+				   const char *input_file)
+{
+	unsigned int i, code, min = KEY_CNT, max = 0;
+
+	for (i = 0; i < buttons->nbuttons; i++) {
+		code = buttons->key_codes[i];
+
+		if (code >= KEY_CNT ||
+		    !libevdev_has_event_code(buttons->evdev, EV_KEY, code)) {
+			fprintf(stderr, "%s: key code 0x%x not reported, its LED stays off\n",
+				input_file, code);
+			continue;
+		}
+
+		if (code < min)
+			min = code;
+		if (code > max)
+			max = code;
+	}
+
+	free(buttons->key_masks);
+	buttons->key_masks = NULL;
+	buttons->key_min = 0;
+	buttons->key_range = 0;
+
+	if (min > max)
+		return 0;
+
+	buttons->key_masks = calloc(max - min + 1, sizeof(*buttons->key_masks));
+	if (!buttons->key_masks) {
+		fprintf(stderr, "Can't allocate buttons key table\n");
+		return -1;
+	}
+	buttons->key_min = min;
+	buttons->key_range = max - min + 1;
+
+	for (i = 0; i < buttons->nbuttons; i++) {
+		code = buttons->key_codes[i];
+
+		if (code >= min && code <= max &&
+		    libevdev_has_event_code(buttons->evdev, EV_KEY, code))
+			buttons->key_masks[code - min] |= 1u << i;
+	}
+
+	return 0;
+}
+
+int buttons_attach(struct buttons *buttons, const char *input_file)
+{
+	buttons->fd = open(input_file, O_RDONLY | O_NONBLOCK);
+	if (buttons->fd < 0) {
+		fprintf(stderr, "Can't open %s\n", input_file);
+		goto out;
+	}
+
+	if (libevdev_new_from_fd(buttons->fd, &buttons->evdev) < 0) {
+		fprintf(stderr, "Can't init libevdev for %s\n", input_file);
+		goto out;
+	}
+
+	if (strncmp("atmel_ptc", libevdev_get_name(buttons->evdev), strlen("atmel_ptc"))) {
+		fprintf(stderr, "%s is not a buttons input device from the PTC\n", input_file);
+		goto out;
+	}
+
+	/* Same clock as the scrollers, to measure the LED latencies. */
+	buttons->latency = !libevdev_set_clock_id(buttons->evdev, CLOCK_MONOTONIC);
+
+	if (buttons_build_key_masks(buttons, input_file))
+		goto out;
+
+	return 0;
+
+out:
+	buttons_detach(buttons);
+	return -1;
+}
+
+struct buttons *initialize_buttons(const char *input_file,
+	const unsigned int *key_codes, const struct gpio_led_desc *leds,
+	unsigned int nbuttons)
+{
+	struct buttons *buttons;
+
+	if (nbuttons > GPIO_LED_BANK_MAX_LEDS) {
+		fprintf(stderr, "%s: %u buttons, at most %d\n", input_file,
+			nbuttons, GPIO_LED_BANK_MAX_LEDS);
+		return NULL;
+	}
+
+	buttons = calloc(1, sizeof(*buttons));
+	if (!buttons) {
+		fprintf(stderr, "Can't allocate buttons\n");
+		return NULL;
+	}
+
+	buttons->fd = -1;
+	buttons->key_codes = key_codes;
+	buttons->nbuttons = nbuttons;
+
+	if (buttons_attach(buttons, input_file))
+		goto out;
+
+	if (gpio_led_bank_request(&buttons->bank, leds, nbuttons)) {
+		fprintf(stderr, "can't get gpio lines for buttons leds\n");
+		goto out;
+	}
+
+	return buttons;
+
+out:
+	remove_buttons(buttons);
+	return NULL;
+}
+
+static unsigned int scroller_led_mask(const struct scroller *scroller,
+				      const struct scroller_frame *frame)
+{
+	int index = (int)frame->abs_value - scroller->led_min;
+
+	if (index < 0)
+		index = 0;
+	else if (index >= (int)scroller->led_range)
+		index = scroller->led_range - 1;
+
+	return scroller->led_masks[index];
+}
+
+void scroller_leds_frame_update(struct scroller *scroller,
+				const struct scroller_frame *frame, void *arg)
+{
+	if (frame->has_key && frame->key_value == 0)
+		gpio_led_bank_set(&scroller->bank, 0);
+	else if (frame->has_abs && scroller->led_masks)
+		gpio_led_bank_set(&scroller->bank, scroller_led_mask(scroller, frame));
+}
+
+void scroller_position_frame_update(struct scroller *scroller,
+				    const struct scroller_frame *frame, void *arg)
+{
+	unsigned int *position = arg;
+
+	if (frame->has_key && frame->key_value == 0)
+		*position = 0;
+	else if (frame->has_abs)
+		*position = frame->abs_value;
+}
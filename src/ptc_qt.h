@@ -20,33 +20,206 @@
 #ifndef _ATQT_H
 #define _ATQT_H
 
-struct gpio_led_desc;
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <linux/input.h>
+
+#include "counter.h"
+#include "gpio_helper.h"
+#include "predictor.h"
+
+#define SCROLLER_MAX_FRAME_EVENTS	64
+#define SCROLLER_BULK_EVENTS		256
+
 struct libevdev;
 
 struct buttons {
 	int fd;
 	struct libevdev *evdev;
-	unsigned int *key_codes;
-	struct gpio_led_desc *leds;
+	const unsigned int *key_codes;
+	unsigned int nbuttons;
+	struct gpio_led_bank bank;
+	/*
+	 * Bits of the buttons of each key code from key_min, 0 for the codes
+	 * not configured or not reported by the device: an event is
+	 * dispatched with one lookup, whatever the number of buttons.
+	 */
+	unsigned int *key_masks;
+	unsigned int key_min;
+	unsigned int key_range;
+	/* LEDs of the buttons changed in the current frame. */
+	unsigned int led_dirty;
+	/* Bit i set while key_codes[i] is pressed, as of the event at time. */
+	unsigned int pressed;
+	struct timeval time;
+	/* Events read, SYN_REPORT frames and read errors, see counter.h. */
+	atomic_ulong events_read;
+	atomic_ulong frames;
+	atomic_ulong errors;
+	atomic_ulong sync_dropped;
+	atomic_ulong sync_events;
+	/*
+	 * LED latencies of the key changes, recorded when the event timestamps
+	 * use CLOCK_MONOTONIC: from the kernel timestamp of the last change to
+	 * its LEDs being flushed, and to the end of the write.
+	 */
+	bool latency;
+	struct latency_hist read_latency;
+	struct latency_hist total_latency;
+};
+
+/*
+ * Events received up to a SYN_REPORT, reduced to the last ABS value and the
+ * last key state reported. events gives the raw events of the frame, without
+ * the terminating SYN_REPORT: up to SCROLLER_MAX_FRAME_EVENTS of them copied
+ * from libevdev, or a slice of the read buffer itself in bulk read mode. It
+ * is only valid during the frame_update callback.
+ */
+struct scroller_frame {
+	struct timeval time;
+	const struct input_event *events;
+	unsigned int nevents;
+	bool has_abs;
+	unsigned int abs_value;
+	bool has_key;
+	unsigned int key_value;
+	bool resync;
+};
+
+/*
+ * Positions are only forwarded once they leave the step of LEDs last
+ * displayed, size positions from start, by more than margin, the others are
+ * counted in suppressed. The steps are bucket positions long, or those of
+ * the LED table with leds.
+ */
+struct scroller_hysteresis {
+	bool leds;
+	unsigned int bucket;
+	unsigned int margin;
+	bool wrap;
+	int min;
+	int range;
+	bool valid;
+	int start;
+	unsigned int size;
+	unsigned long suppressed;
+};
+
+/*
+ * LED mappings, spread over the whole position range: bar graph (LEDs 0 to
+ * n lit) for the QT1 slider, binary step number from 1 for the QT1 wheel.
+ */
+enum scroller_led_map {
+	SCROLLER_LED_BAR,
+	SCROLLER_LED_WHEEL,
 };
 
 struct scroller {
 	int fd;
 	struct libevdev *evdev;
-	struct gpio_led_desc *leds;
-	unsigned int nleds;
-	void (*position_update)(struct gpio_led_desc *leds, unsigned int nleds,
+	struct gpio_led_bank bank;
+	/*
+	 * LEDs lit for each position from led_min, built from the position
+	 * range for the bar and wheel displays.
+	 */
+	unsigned int *led_masks;
+	bool led_wheel;
+	int led_min;
+	unsigned int led_range;
+	void (*position_update)(struct gpio_led_bank *bank,
 				unsigned int ev_type, unsigned int ev_value,
 				void *arg);
+	void (*frame_update)(struct scroller *scroller,
+			     const struct scroller_frame *frame, void *arg);
+	struct scroller_frame frame;
+	struct input_event events[SCROLLER_MAX_FRAME_EVENTS];
+	struct input_event *bulk_events;
+	unsigned int bulk_count;
+	int abs_code;
+	int key_code;
+	/* abs_value of the frames replaced by the predicted position. */
+	bool predict;
+	struct predictor predictor;
+	bool hold;
+	struct scroller_hysteresis hysteresis;
+	/* State as of the last frame delivered, at the time of its event. */
+	bool touched;
+	unsigned int position;
+	struct timeval time;
+	/* Events read, SYN_REPORT frames and read errors, see counter.h. */
+	atomic_ulong events_read;
+	atomic_ulong frames;
+	atomic_ulong errors;
+	atomic_ulong sync_dropped;
+	atomic_ulong sync_events;
+	/*
+	 * Frame latencies, recorded when the event timestamps use
+	 * CLOCK_MONOTONIC: from the kernel timestamp to the frame being read,
+	 * spent in frame_update, and from the kernel timestamp to the end of
+	 * frame_update, so including the LED update.
+	 */
+	bool latency;
+	struct latency_hist read_latency;
+	struct latency_hist callback_latency;
+	struct latency_hist total_latency;
 };
 
+/*
+ * The event handlers return -ENODEV when the input device is gone, e.g.
+ * because the driver was unloaded, and -1 on other errors. The device can
+ * be closed with *_detach() and opened again with *_attach() once back,
+ * see hotplug.h.
+ */
+int button_event_handler(struct buttons *buttons);
+struct buttons *initialize_buttons(const char *input_file,
+	const unsigned int *key_codes, const struct gpio_led_desc *leds,
+	unsigned int nbuttons);
+void remove_buttons(struct buttons *buttons);
+int buttons_attach(struct buttons *buttons, const char *input_file);
+void buttons_detach(struct buttons *buttons);
+void buttons_print_latency(const struct buttons *buttons, FILE *f,
+			   const char *name);
+void buttons_print_counters(const struct buttons *buttons, FILE *f,
+			    const char *name);
+
 int scroller_event_handler(struct scroller *scroller, void *arg);
 struct scroller *initialize_scroller(const char *input_file,
-	struct gpio_led_desc *leds, unsigned int nleds,
-	void (*position_update)(struct gpio_led_desc *leds, unsigned int nleds,
+	const struct gpio_led_desc *leds, unsigned int nleds,
+	void (*position_update)(struct gpio_led_bank *bank,
 				unsigned int ev_type, unsigned int ev_value,
 				void *arg)
 	);
+struct scroller *initialize_scroller_frames(const char *input_file,
+	const struct gpio_led_desc *leds, unsigned int nleds,
+	void (*frame_update)(struct scroller *scroller,
+			     const struct scroller_frame *frame, void *arg)
+	);
+int scroller_set_bulk_read(struct scroller *scroller, bool enable);
+int scroller_set_led_map(struct scroller *scroller, enum scroller_led_map map);
+int scroller_set_prediction(struct scroller *scroller, unsigned int lead_ms,
+			    bool wrap);
+int scroller_set_hysteresis(struct scroller *scroller, unsigned int bucket,
+			    unsigned int margin, bool wrap);
+int scroller_set_led_hysteresis(struct scroller *scroller, unsigned int margin);
+void *scroller_bulk_buffer(struct scroller *scroller, size_t *size);
+int scroller_bulk_complete(struct scroller *scroller, ssize_t len, void *arg);
+void scroller_print_latency(const struct scroller *scroller, FILE *f,
+			    const char *name);
+void scroller_print_counters(const struct scroller *scroller, FILE *f,
+			     const char *name);
 void remove_scroller(struct scroller *scroller);
+int scroller_attach(struct scroller *scroller, const char *input_file);
+void scroller_detach(struct scroller *scroller);
+
+/*
+ * LED display of the QT1 slider and wheel, with the mapping set by
+ * scroller_set_led_map(), and position tracking for 2D surfaces: arg points
+ * to an unsigned int receiving the position, 0 when released.
+ */
+void scroller_leds_frame_update(struct scroller *scroller,
+				const struct scroller_frame *frame, void *arg);
+void scroller_position_frame_update(struct scroller *scroller,
+				    const struct scroller_frame *frame, void *arg);
 
 #endif /* _ATQT_H */
@@ -19,7 +19,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
-#include <poll.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -28,330 +28,185 @@
 
 #include <libevdev-1.0/libevdev/libevdev.h>
 
+#include "event_loop.h"
+#include "hotplug.h"
+#include "launcher.h"
 #include "ptc_qt.h"
+#include "rt.h"
+#include "stats_file.h"
 #include "gpio_helper.h"
 
-#define BUTTONS_INPUT_FILE	"/dev/input/atmel_ptc0"
-#define SLIDER_INPUT_FILE	"/dev/input/atmel_ptc1"
-#define WHEEL_INPUT_FILE	"/dev/input/atmel_ptc2"
-#define POLL_NFDS		3
+/* Generated from the board file selected by PTC_QT1_BOARD. */
+#include "board_tables.h"
 
-#ifdef SELFCAP
-#define NUMBER_OF_BUTTONS	1
-#define SLIDER_NB_OF_LEDS	8
-#define WHEEL_NB_OF_LEDS	3
+static struct buttons *buttons;
+static struct scroller *slider, *wheel;
+static struct hotplug *hotplug;
+static struct stats_file *stats_file;
 
-static unsigned int buttons_keycodes[NUMBER_OF_BUTTONS] = {
-	0x106,
-};
-
-#ifdef SAMA5D27_WLSOM1_EK
-static struct gpio_led_desc buttons_leds[1] = {
-	{ .pin_id = 103},	/* PD7 */
-};
-
-static struct gpio_led_desc slider_leds[SLIDER_NB_OF_LEDS] = {
-	{ .led_id = 0, .pin_id = 62 },	/* PB30 */
-	{ .led_id = 1, .pin_id = 33 },	/* PB1 */
-	{ .led_id = 2, .pin_id = 14 },	/* PA14 */
-	{ .led_id = 3, .pin_id = 32 },	/* PB0 */
-	{ .led_id = 4, .pin_id = 99 },	/* PD3 */
-	{ .led_id = 5, .pin_id = 100 },	/* PD4 */
-	{ .led_id = 6, .pin_id = 101 },	/* PD5 */
-	{ .led_id = 7, .pin_id = 102 },	/* PD6 */
-};
-
-static struct gpio_led_desc wheel_leds[WHEEL_NB_OF_LEDS] = {
-	{ .pin_id = 105 },	/* PD9 */
-	{ .pin_id = 106 },	/* PD10 */
-	{ .pin_id = 71 },	/* PC07 */
-};
-#else
-static struct gpio_led_desc buttons_leds[1] = {
-	{ .pin_id = 104},	/* PD8 */
-};
-
-static struct gpio_led_desc slider_leds[SLIDER_NB_OF_LEDS] = {
-	{ .led_id = 0, .pin_id = 41 },	/* PB9 */
-	{ .led_id = 1, .pin_id = 64 },	/* PC0 */
-	{ .led_id = 2, .pin_id = 113 },	/* PD17 */
-	{ .led_id = 3, .pin_id = 122 },	/* PD26 */
-	{ .led_id = 4, .pin_id = 99 },	/* PD3 */
-	{ .led_id = 5, .pin_id = 100 },	/* PD4 */
-	{ .led_id = 6, .pin_id = 101 },	/* PD5 */
-	{ .led_id = 7, .pin_id = 102 },	/* PD6 */
-};
-
-static struct gpio_led_desc wheel_leds[WHEEL_NB_OF_LEDS] = {
-	{ .pin_id = 105 },	/* PD9 */
-	{ .pin_id = 106 },	/* PD10 */
-	{ .pin_id = 57 },	/* PB25 */
-};
-#endif /* SAMA5D27_WLSOM1_EK */
-#else
-#define NUMBER_OF_BUTTONS	2
-#define WHEEL_NB_OF_LEDS	3
-
-static unsigned int buttons_keycodes[NUMBER_OF_BUTTONS] = {
-	0x108, 0x109,
-};
-
-static struct gpio_led_desc buttons_leds[NUMBER_OF_BUTTONS] = {
-	{ .pin_id = 103 },	/* PD7 */
-	{ .pin_id = 104 },	/* PD8 */
-};
-
-#ifdef SAMA5D27_WLSOM1_EK
-#define SLIDER_NB_OF_LEDS	8
-
-static struct gpio_led_desc slider_leds[SLIDER_NB_OF_LEDS] = {
-	{ .led_id = 0, .pin_id = 107 },	/* PD11 */
-	{ .led_id = 1, .pin_id = 108 },	/* PD12 */
-	{ .led_id = 2, .pin_id = 62 },	/* PB30 */
-	{ .led_id = 3, .pin_id = 33 },	/* PB1 */
-	{ .led_id = 4, .pin_id = 14 },	/* PA14 */
-	{ .led_id = 5, .pin_id = 113 },	/* PD17 */
-	{ .led_id = 6, .pin_id = 32 },	/* PB0 */
-	{ .led_id = 7, .pin_id = 114 },	/* PD18 */
-};
-
-static struct gpio_led_desc wheel_leds[WHEEL_NB_OF_LEDS] = {
-	{ .pin_id = 105 },	/* PD9 */
-	{ .pin_id = 106 },	/* PD10 */
-	{ .pin_id = 71 },	/* PC07 */
-};
-#else
-#define SLIDER_NB_OF_LEDS	7
-
-static struct gpio_led_desc slider_leds[SLIDER_NB_OF_LEDS] = {
-	{ .led_id = 0, .pin_id = 107 },	/* PD11 */
-	{ .led_id = 1, .pin_id = 108 },	/* PD12 */
-	{ .led_id = 2, .pin_id = 41 },	/* PB9 */
-	{ .led_id = 3, .pin_id = 64 },	/* PC0 */
-	{ .led_id = 4, .pin_id = 113 },	/* PD17 */
-	{ .led_id = 5, .pin_id = 114 },	/* PD18 */
-	{ .led_id = 6, .pin_id = 122 },	/* PD26 */
-	/* unused */			/* PD17 */
-};
-
-static struct gpio_led_desc wheel_leds[WHEEL_NB_OF_LEDS] = {
-	{ .pin_id = 105 },	/* PD9 */
-	{ .pin_id = 106 },	/* PD10 */
-	{ .pin_id = 57 },	/* PB25 */
-};
-#endif /* SAMA5D27_WLSOM1_EK */
-#endif /* SELFCAP */
-
-static int button_event_handler(struct buttons *buttons)
+static void write_counters(FILE *f, void *arg)
 {
-	struct input_event ev;
-	int i, ret;
-
-	do {
-		ret = libevdev_next_event(buttons->evdev,
-					  LIBEVDEV_READ_FLAG_NORMAL, &ev);
-		if (ret == LIBEVDEV_READ_STATUS_SYNC) {
-			fprintf(stderr, "error: cannot keep up\n");
-			return -1;
-		} else if (ret != -EAGAIN && ret < 0) {
-			fprintf(stderr, "error: %s\n", strerror(-ret));
-			return -1;
-		} else	if (ret == LIBEVDEV_READ_STATUS_SUCCESS) {
-			for (i = 0; i < NUMBER_OF_BUTTONS; i++) {
-				unsigned int key_code = buttons_keycodes[i];
-
-				if (key_code == ev.code)
-					ev.value ? gpio_led_on(&buttons_leds[i]) : gpio_led_off(&buttons_leds[i]);
-			}
-		}
-	} while (ret != -EAGAIN);
-
-	return ret;
+	buttons_print_counters(buttons, f, "buttons");
+	scroller_print_counters(slider, f, "slider");
+	scroller_print_counters(wheel, f, "wheel");
 }
 
-static void remove_buttons(struct buttons *buttons)
+static void dump_stats(void)
 {
-	int i;
-
-	for (i = 0; i < NUMBER_OF_BUTTONS; i++)
-		gpio_led_release(&buttons_leds[i]);
-
-	if (buttons->evdev)
-		libevdev_free(buttons->evdev);
-
-	if (buttons->fd > 0)
-		close(buttons->fd);
-
-	free(buttons);
+	write_counters(stderr, NULL);
+	if (slider->hold)
+		fprintf(stderr, "hysteresis: %lu slider and %lu wheel positions held\n",
+			slider->hysteresis.suppressed, wheel->hysteresis.suppressed);
+	buttons_print_latency(buttons, stderr, "buttons");
+	scroller_print_latency(slider, stderr, "slider");
+	scroller_print_latency(wheel, stderr, "wheel");
+	if (hotplug)
+		hotplug_print_stats(hotplug, stderr);
 }
 
-static struct buttons *initialize_buttons(void)
+static int buttons_handler(int fd, uint32_t events, void *arg)
 {
-	struct buttons *buttons;
-	unsigned int i;
-
-	buttons = malloc(sizeof(*buttons));
-	if (!buttons) {
-		fprintf(stderr, "Can't allocate buttons\n");
-		return NULL;
-	}
-
-	buttons->fd = open(BUTTONS_INPUT_FILE, O_RDONLY | O_NONBLOCK);
-	if (buttons->fd < 0) {
-		fprintf(stderr, "Can't open %s\n", BUTTONS_INPUT_FILE);
-		goto out;
-	}
-
-	if (libevdev_new_from_fd(buttons->fd, &buttons->evdev) < 0) {
-		fprintf(stderr, "Can't init libevdev for %s\n", BUTTONS_INPUT_FILE);
-		goto out;
-	}
-
-	if (strncmp("atmel_ptc", libevdev_get_name(buttons->evdev), strlen("atmel_ptc"))) {
-		fprintf(stderr, "%s is not a buttons input device from the PTC\n", BUTTONS_INPUT_FILE);
-		goto out;
-	}
-
-	for (i = 0; i < NUMBER_OF_BUTTONS; i++) {
-		if (gpio_led_request(&buttons_leds[i])) {
-			fprintf(stderr, "can't get gpio line for button %d led\n", i);
-			goto out;
-		}
-	}
-
-	return buttons;
+	return button_event_handler(arg);
+}
 
-out:
-	remove_buttons(buttons);
-	return NULL;
+static int scroller_handler(int fd, uint32_t events, void *arg)
+{
+	return scroller_event_handler(arg, NULL);
 }
 
-static void slider_position_update(struct gpio_led_desc *leds, unsigned int nleds,
-				   unsigned int ev_type, unsigned int ev_value,
-				   void *arg)
+static int quit_handler(int signo, void *arg)
 {
-	unsigned int i, display_value;
+	return 1;
+}
 
-	if (ev_type == EV_KEY) {
-		if (ev_value == 0) {
-			for (i = 0; i < nleds; i++)
-				gpio_led_off(&leds[i]);
-		}
-	} else if (ev_type == EV_ABS) {
-		/*
-		 * ev_value range is from 0 to 63 (depends on scroller resolution),
-		 * split it into 8 parts for display.
-		 */
-		display_value = ev_value / 8;
-		for (i = 0; i < nleds; i++) {
-			if (leds[i].led_id <= display_value)
-				gpio_led_on(&leds[i]);
-			else
-				gpio_led_off(&leds[i]);
-		}
-	}
+static int stats_handler(int signo, void *arg)
+{
+	dump_stats();
+	if (stats_file)
+		stats_file_refresh(stats_file);
+	return 0;
 }
 
-static void wheel_position_update(struct gpio_led_desc *leds, unsigned int nleds,
-				  unsigned int ev_type, unsigned int ev_value,
-				  void *arg)
+static void usage(const char *prog)
 {
-	unsigned int i;
+	fprintf(stderr, "usage: %s [options]\noptions:\n"
+		"  -e ms       display the touch position this far ahead (prediction)\n"
+		"  -m margin   only update the LEDs past this margin (hysteresis)\n"
+		STATS_FILE_USAGE LAUNCHER_USAGE RT_USAGE, prog);
+}
 
-	if (ev_type == EV_KEY) {
-		if (ev_value == 0) {
-			for (i = 0; i < nleds; i++)
-				gpio_led_off(&leds[i]);
+int main(int argc, char **argv)
+{
+	static const char * const input_files[] = {
+		BUTTONS_INPUT_FILE, SLIDER_INPUT_FILE, WHEEL_INPUT_FILE,
+	};
+	struct launcher launcher = LAUNCHER_INIT;
+	struct rt_options rt = RT_OPTIONS_INIT;
+	const char *stats_path = NULL;
+	unsigned int lead_ms = 0;
+	int margin = -1;
+	int opt, ret = -1;
+	struct event_loop *loop;
+
+	while ((opt = getopt(argc, argv, "e:m:o:" LAUNCHER_OPTSTRING RT_OPTSTRING)) != -1) {
+		if (opt == 'e') {
+			lead_ms = strtoul(optarg, NULL, 0);
+		} else if (opt == 'm') {
+			margin = strtol(optarg, NULL, 0);
+		} else if (opt == 'o') {
+			stats_path = optarg;
+		} else if (opt == 'l') {
+			launcher.config = optarg;
+		} else if (rt_parse_option(&rt, opt, optarg)) {
+			usage(argv[0]);
+			return EXIT_FAILURE;
 		}
-	} else if (ev_type == EV_ABS) {
-		/*
-		 * Values from 0 to 63, split it into 7 parts,
-		 * update it if resolution is different.
-		 */
-		ev_value = ev_value / 10 + 1;
-		for (i = 0; i < nleds; i++)
-			((ev_value >> i) & 0x1) ? gpio_led_on(&leds[i]) : gpio_led_off(&leds[i]);
 	}
-}
 
-int main(void)
-{
-	int ret, i;
-	struct buttons *buttons;
-	struct scroller *slider, *wheel;
-	struct pollfd fds[POLL_NFDS];
+	if (launcher_start(&launcher, input_files, 3))
+		return EXIT_FAILURE;
 
 	if (gpio_init())
 		return EXIT_FAILURE;
 
-	buttons = initialize_buttons();
+	loop = event_loop_new();
+	if (!loop)
+		goto loop_fail;
+
+	buttons = initialize_buttons(BUTTONS_INPUT_FILE, buttons_keycodes,
+				     buttons_leds, NUMBER_OF_BUTTONS);
 	if (!buttons)
 		goto buttons_fail;
 
-	slider = initialize_scroller(SLIDER_INPUT_FILE, slider_leds,
-				     SLIDER_NB_OF_LEDS,
-				     slider_position_update);
+	slider = initialize_scroller_frames(SLIDER_INPUT_FILE, slider_leds,
+					    SLIDER_NB_OF_LEDS,
+					    scroller_leds_frame_update);
 	if (!slider)
 		goto slider_fail;
 
-	wheel = initialize_scroller(WHEEL_INPUT_FILE, wheel_leds,
-				    WHEEL_NB_OF_LEDS,
-				    wheel_position_update);
+	wheel = initialize_scroller_frames(WHEEL_INPUT_FILE, wheel_leds,
+					   WHEEL_NB_OF_LEDS,
+					   scroller_leds_frame_update);
 	if (!wheel)
 		goto wheel_fail;
 
-	fds[0].fd = buttons->fd;
-	fds[0].events = POLLIN;
-	fds[1].fd = slider->fd;
-	fds[1].events = POLLIN;
-	fds[2].fd = wheel->fd;
-	fds[2].events = POLLIN;
-
-	printf("demo running...\n");
-	while (1) {
-		ret = poll(fds, POLL_NFDS, -1);
-		if (ret < 0) {
-			fprintf(stderr, "poll() failed\n");
-			break;
-		}
-
-		for (i = 0; i < POLL_NFDS; i++) {
-			if (fds[i].revents == 0)
-				continue;
+	if (scroller_set_led_map(slider, SCROLLER_LED_BAR) ||
+	    scroller_set_led_map(wheel, SCROLLER_LED_WHEEL))
+		goto loop_setup_fail;
+
+	if (scroller_set_prediction(slider, lead_ms, false) ||
+	    scroller_set_prediction(wheel, lead_ms, true))
+		goto loop_setup_fail;
+
+	if (margin >= 0 &&
+	    (scroller_set_led_hysteresis(slider, margin) ||
+	     scroller_set_led_hysteresis(wheel, margin)))
+		goto loop_setup_fail;
+
+	hotplug = hotplug_new(loop);
+	if (!hotplug ||
+	    hotplug_add_buttons(hotplug, buttons, BUTTONS_INPUT_FILE,
+				buttons_handler, buttons) ||
+	    hotplug_add_scroller(hotplug, slider, SLIDER_INPUT_FILE,
+				 scroller_handler, slider) ||
+	    hotplug_add_scroller(hotplug, wheel, WHEEL_INPUT_FILE,
+				 scroller_handler, wheel) ||
+	    !event_loop_add_signal(loop, SIGINT, 0, quit_handler, NULL) ||
+	    !event_loop_add_signal(loop, SIGTERM, 0, quit_handler, NULL) ||
+	    !event_loop_add_signal(loop, SIGUSR1, 0, stats_handler, NULL))
+		goto loop_setup_fail;
+
+	if (stats_path) {
+		stats_file = stats_file_start(loop, stats_path, STATS_FILE_PERIOD_MS,
+					      write_counters, NULL);
+		if (!stats_file)
+			goto loop_setup_fail;
+	}
 
-			if (fds[i].revents != POLLIN) {
-				fprintf(stderr, "error, revents = %d\n", fds[i].revents);
-				break;
-			}
+	/* Reported, but not fatal: the demo still works, with more jitter. */
+	rt_apply(&rt);
 
-			if (fds[i].fd == buttons->fd) {
-				ret = button_event_handler(buttons);
-				if (ret)
-					break;
-			}
+	launcher_ready(&launcher);
 
-			if (fds[i].fd == slider->fd) {
-				ret = scroller_event_handler(slider, NULL);
-				if (ret)
-					break;
-			}
+	printf("demo running...\n");
+	ret = event_loop_run(loop);
+	if (ret < 0)
+		fprintf(stderr, "event error\n");
 
-			if (fds[i].fd == wheel->fd) {
-				ret = scroller_event_handler(wheel, NULL);
-				if (ret)
-					break;
-			}
-		}
-	}
-	fprintf(stderr, "event error\n");
+	dump_stats();
 
+loop_setup_fail:
+	stats_file_stop(stats_file);
+	hotplug_free(hotplug);
 	remove_scroller(wheel);
 wheel_fail:
 	remove_scroller(slider);
 slider_fail:
 	remove_buttons(buttons);
 buttons_fail:
+	event_loop_free(loop);
+loop_fail:
 	gpio_fini();
 
-	return EXIT_FAILURE;
+	return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -19,164 +19,339 @@
 
 #include <errno.h>
 #include <fcntl.h>
-#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 
-#include <linux/i2c-dev.h>
-
 #include <libevdev-1.0/libevdev/libevdev.h>
 
+#include "event_loop.h"
+#include "fusion.h"
+#include "hotplug.h"
+#include "launcher.h"
+#include "is31fl3728.h"
+#include "pipeline.h"
 #include "ptc_qt.h"
+#include "rt.h"
+#include "stats_file.h"
 
 #define SLIDER_X_INPUT_FILE	"/dev/input/atmel_ptc0"
 #define SLIDER_Y_INPUT_FILE	"/dev/input/atmel_ptc1"
-#define POLL_NFDS		2
+/* Positions per column and per row of the LED matrix. */
+#define MATRIX_X_BUCKET		10
+#define MATRIX_Y_BUCKET		9
 
 #define IS31FL3728_ADDR			0x60
-#define IS31FL3728_UPDATE_COLUMN_REG	0xc
 #define I2C_DEVICE_FILE			"/dev/i2c-1"
 
-int i2c_fd;
-char col_state[7] = {0};
-
-static void led_update()
+static struct is31fl3728 matrix;
+static struct scroller *slider_x, *slider_y;
+static unsigned int pos_x, pos_y;
+/* Set in pipelined mode: the matrix is driven from the output thread. */
+static struct pipeline *pipeline;
+/* Epoll loop only: the io_uring reads don't follow the devices. */
+static struct hotplug *hotplug;
+static struct fusion *fusion;
+/* First error of the fused outputs, stops the demo. */
+static int output_ret;
+static struct stats_file *stats_file;
+
+static int led_update(unsigned int xpos, unsigned int ypos)
 {
-	char buf[2];
+	is31fl3728_clear(&matrix);
+
+	/* xpos: 0 to 63, ypos: 0 to 57 */
+	if (xpos && ypos)
+		is31fl3728_set_column(&matrix, xpos / MATRIX_X_BUCKET,
+				      0b01000000 >> (ypos / MATRIX_Y_BUCKET));
 
-	buf[0] = IS31FL3728_UPDATE_COLUMN_REG;
-	buf[1] = 0x1;
-	if (write(i2c_fd, buf, 2) != 2) {
-		fprintf(stderr, "Failed to write to the i2c bus\n");
-		exit(EXIT_FAILURE);
+	return is31fl3728_flush(&matrix);
+}
+
+/* One matrix update per X/Y sample. */
+static int fused_output(const struct fusion_sample *sample, void *arg)
+{
+	/* Both axes in one record, the output thread never sees them torn. */
+	if (pipeline) {
+		pipeline_push(pipeline, 0,
+			      sample->position[0] << 16 | sample->position[1],
+			      &sample->time);
+		return 0;
 	}
+
+	return led_update(sample->position[0], sample->position[1]);
 }
 
-static void led_all_off(void)
+static void slider_frame_update(struct scroller *scroller,
+				const struct scroller_frame *frame, void *arg)
 {
-	char buf[2];
-	int i;
+	unsigned int *position = arg;
+	int ret;
 
-	buf[1] = 0;
-	for (i = 0; i < 8; i++) {
-		buf[0] = i;
-		if (write(i2c_fd, buf, 2) != 2) {
-			fprintf(stderr, "Failed to write to the i2c bus\n");
-			exit(EXIT_FAILURE);
-		}
-	}
+	scroller_position_frame_update(scroller, frame, arg);
 
-	led_update();
+	ret = fusion_update(fusion, position == &pos_y, &frame->time,
+			    scroller->touched, *position);
+	if (ret && !output_ret)
+		output_ret = ret;
 }
 
-static void led_on(int xpos, int ypos)
+static void matrix_output(const struct pipeline_record *state,
+			  unsigned int updated, void *arg)
 {
-	char buf[2];
+	led_update(state[0].value >> 16, state[0].value & 0xffff);
+}
 
-	led_all_off();
+static int slider_x_handler(int fd, uint32_t events, void *arg)
+{
+	int ret;
 
-	if (!xpos && !ypos)
-		return;
+	ret = scroller_event_handler(arg, &pos_x);
 
-	/* xpos: 0 to 63, ypos: 0 to 57 */
-	buf[0] = 1 + xpos / 10;
-	buf[1] = 0b01000000 >> (ypos / 9);
+	return ret ? ret : output_ret;
+}
 
-	if (write(i2c_fd, buf, 2) != 2) {
-		fprintf(stderr, "Failed to write to the i2c bus\n");
-		exit(EXIT_FAILURE);
-	}
+static int slider_y_handler(int fd, uint32_t events, void *arg)
+{
+	int ret;
+
+	ret = scroller_event_handler(arg, &pos_y);
 
-	led_update();
+	return ret ? ret : output_ret;
 }
 
-static void slider_position_update(struct gpio_led_desc *leds, unsigned int nleds,
-				    unsigned int ev_type, unsigned int ev_value,
-				    void *arg)
+static void *slider_buffer(void *arg, size_t *size)
 {
-	unsigned int *position = arg;
+	return scroller_bulk_buffer(arg, size);
+}
 
-	if (ev_type == EV_KEY)
-		if (ev_value == 0)
-			*position = 0;
+/* Read sources, for the io_uring loop: the reads are done by the kernel. */
+static int slider_x_read(int fd, ssize_t len, void *arg)
+{
+	int ret;
+
+	ret = scroller_bulk_complete(arg, len, &pos_x);
 
-	if (ev_type == EV_ABS)
-		*position = ev_value;
+	return ret ? ret : output_ret;
 }
 
-int main(void)
+static int slider_y_read(int fd, ssize_t len, void *arg)
 {
-	struct scroller *slider_x, *slider_y;
-	int pos_x = 0, pos_y = 0, i, ret;
-	struct pollfd fds[POLL_NFDS];
+	int ret;
 
-	if ((i2c_fd = open(I2C_DEVICE_FILE, O_RDWR)) < 0) {
-		fprintf(stderr, "Can't open %s\n", I2C_DEVICE_FILE);
-		return EXIT_FAILURE;
-	}
+	ret = scroller_bulk_complete(arg, len, &pos_y);
 
-	if (ioctl(i2c_fd, I2C_SLAVE, IS31FL3728_ADDR) < 0) {
-		fprintf(stderr, "Failed to acquire bus access and/or talk to slave\n");
-		goto out;
+	return ret ? ret : output_ret;
+}
+
+static int pipeline_handler(int fd, uint32_t events, void *arg)
+{
+	return pipeline_room_handler(arg);
+}
+
+static int quit_handler(int signo, void *arg)
+{
+	return 1;
+}
+
+static void write_counters(FILE *f, void *arg)
+{
+	scroller_print_counters(slider_x, f, "slider_x");
+	scroller_print_counters(slider_y, f, "slider_y");
+	is31fl3728_print_counters(&matrix, f, "matrix");
+	if (fusion)
+		fprintf(f, "fusion frames=%lu samples=%lu pairs=%lu\n",
+			fusion->frames, fusion->samples, fusion->paired);
+	if (pipeline)
+		fprintf(f, "pipeline records=%lu coalesced=%lu overflows=%lu "
+			"outputs=%lu\n", counter_read(&pipeline->pushed),
+			counter_read(&pipeline->coalesced),
+			counter_read(&pipeline->overflows),
+			counter_read(&pipeline->outputs));
+}
+
+static void dump_stats(void)
+{
+	write_counters(stderr, NULL);
+	scroller_print_latency(slider_x, stderr, "slider x");
+	scroller_print_latency(slider_y, stderr, "slider y");
+	latency_hist_print(&matrix.write_latency, stderr, "matrix", "write");
+	if (slider_x->hold)
+		fprintf(stderr, "hysteresis: %lu x and %lu y positions held\n",
+			slider_x->hysteresis.suppressed, slider_y->hysteresis.suppressed);
+	if (pipeline)
+		latency_hist_print(&pipeline->output_latency, stderr, "pipeline",
+				   "touch to matrix");
+	if (hotplug)
+		hotplug_print_stats(hotplug, stderr);
+}
+
+static int stats_handler(int signo, void *arg)
+{
+	dump_stats();
+	if (stats_file)
+		stats_file_refresh(stats_file);
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [options]\noptions:\n"
+		"  -t          drive the LED matrix from its own thread\n"
+		"  -u          use io_uring for the touch reads and matrix writes\n"
+		"  -e ms       display the touch position this far ahead (prediction)\n"
+		"  -m margin   only update the LEDs past this margin (hysteresis)\n"
+		FUSION_USAGE
+		STATS_FILE_USAGE LAUNCHER_USAGE RT_USAGE, prog);
+}
+
+int main(int argc, char **argv)
+{
+	static const char * const input_files[] = {
+		SLIDER_X_INPUT_FILE, SLIDER_Y_INPUT_FILE,
+	};
+	struct launcher launcher = LAUNCHER_INIT;
+	struct event_loop *loop;
+	const char *i2c_file, *stats_path = NULL;
+	struct rt_options rt = RT_OPTIONS_INIT;
+	bool pipelined = false, uring = false;
+	unsigned int lead_ms = 0, window_us = FUSION_DEFAULT_WINDOW_US;
+	int margin = -1;
+	int opt, ret = -1;
+
+	while ((opt = getopt(argc, argv, "tue:m:w:o:" LAUNCHER_OPTSTRING RT_OPTSTRING)) != -1) {
+		if (opt == 'e') {
+			lead_ms = strtoul(optarg, NULL, 0);
+		} else if (opt == 'm') {
+			margin = strtol(optarg, NULL, 0);
+		} else if (opt == 'w') {
+			window_us = strtoul(optarg, NULL, 0);
+		} else if (opt == 't') {
+			pipelined = true;
+		} else if (opt == 'u') {
+			uring = true;
+		} else if (opt == 'o') {
+			stats_path = optarg;
+		} else if (opt == 'l') {
+			launcher.config = optarg;
+		} else if (rt_parse_option(&rt, opt, optarg)) {
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
 	}
 
-	slider_x = initialize_scroller(SLIDER_X_INPUT_FILE, NULL, 0,
-				       slider_position_update);
+	/* PTC_I2C_DEVICE can point the demo to another bus, e.g. i2c-stub. */
+	i2c_file = getenv("PTC_I2C_DEVICE");
+	if (!i2c_file)
+		i2c_file = I2C_DEVICE_FILE;
+
+	if (launcher_start(&launcher, input_files, 2))
+		return EXIT_FAILURE;
+
+	if (is31fl3728_open(&matrix, i2c_file, IS31FL3728_ADDR))
+		return EXIT_FAILURE;
+
+	slider_x = initialize_scroller_frames(SLIDER_X_INPUT_FILE, NULL, 0,
+					      slider_frame_update);
 	if (!slider_x)
 		goto out;
 
-	slider_y = initialize_scroller(SLIDER_Y_INPUT_FILE, NULL, 0,
-				       slider_position_update);
+	slider_y = initialize_scroller_frames(SLIDER_Y_INPUT_FILE, NULL, 0,
+					      slider_frame_update);
 	if (!slider_y)
 		goto slider_y_fail;
 
-	fds[0].fd = slider_x->fd;
-	fds[0].events = POLLIN;
-	fds[1].fd = slider_y->fd;
-	fds[1].events = POLLIN;
+	if (scroller_set_prediction(slider_x, lead_ms, false) ||
+	    scroller_set_prediction(slider_y, lead_ms, false))
+		goto loop_fail;
+
+	if (margin >= 0 &&
+	    (scroller_set_hysteresis(slider_x, MATRIX_X_BUCKET, margin, false) ||
+	     scroller_set_hysteresis(slider_y, MATRIX_Y_BUCKET, margin, false)))
+		goto loop_fail;
+
+	loop = uring ? event_loop_new_uring() : event_loop_new();
+	if (!loop)
+		goto loop_fail;
+
+	fusion = fusion_new(loop, window_us, fused_output, NULL);
+	if (!fusion)
+		goto loop_setup_fail;
+
+	if (event_loop_is_uring(loop)) {
+		if (scroller_set_bulk_read(slider_x, true) ||
+		    scroller_set_bulk_read(slider_y, true) ||
+		    !event_loop_add_read(loop, slider_x->fd, 0, slider_buffer,
+					 slider_x_read, slider_x) ||
+		    !event_loop_add_read(loop, slider_y->fd, 0, slider_buffer,
+					 slider_y_read, slider_y))
+			goto loop_setup_fail;
+
+		/* The output thread can't queue writes on the loop. */
+		if (!pipelined)
+			is31fl3728_set_loop(&matrix, loop);
+	} else {
+		hotplug = hotplug_new(loop);
+		if (!hotplug ||
+		    hotplug_add_scroller(hotplug, slider_x, SLIDER_X_INPUT_FILE,
+					 slider_x_handler, slider_x) ||
+		    hotplug_add_scroller(hotplug, slider_y, SLIDER_Y_INPUT_FILE,
+					 slider_y_handler, slider_y))
+			goto loop_setup_fail;
+	}
 
-	printf("demo running...\n");
-	while (1) {
-		ret = poll(fds, POLL_NFDS, - 1);
-		if (ret < 0) {
-			fprintf(stderr, "poll() failed\n");
-			break;
-		}
+	if (!event_loop_add_signal(loop, SIGINT, 0, quit_handler, NULL) ||
+	    !event_loop_add_signal(loop, SIGTERM, 0, quit_handler, NULL) ||
+	    !event_loop_add_signal(loop, SIGUSR1, 0, stats_handler, NULL))
+		goto loop_setup_fail;
 
-		for (i = 0; i < POLL_NFDS; i++) {
-			if (fds[i].revents == 0)
-				continue;
-
-			if (fds[i].revents != POLLIN) {
-				fprintf(stderr, "error, revents = %d\n", fds[i].revents);
-				break;
-			}
-
-			if (fds[i].fd == slider_x->fd) {
-				ret = scroller_event_handler(slider_x, &pos_x);
-				if (ret)
-					break;
-			}
-
-			if (fds[i].fd == slider_y->fd) {
-				ret = scroller_event_handler(slider_y, &pos_y);
-				if (ret)
-					break;
-			}
-		}
+	if (stats_path) {
+		stats_file = stats_file_start(loop, stats_path, STATS_FILE_PERIOD_MS,
+					      write_counters, NULL);
+		if (!stats_file)
+			goto loop_setup_fail;
+	}
+
+	/* Reported, but not fatal: the demo still works, with more jitter. */
+	rt_apply(&rt);
 
-		if (pos_x && pos_y)
-			led_on(pos_x, pos_y);
-		else
-			led_all_off();
+	/* Started after rt_apply() so that the output thread inherits it. */
+	if (pipelined) {
+		pipeline = pipeline_start(matrix_output, NULL);
+		if (!pipeline)
+			goto loop_setup_fail;
+
+		if (!event_loop_add_fd(loop, pipeline->room_fd, 0, 0,
+				       pipeline_handler, pipeline))
+			goto pipeline_fail;
 	}
-	fprintf(stderr, "event error\n");
 
+	launcher_ready(&launcher);
+
+	printf("demo running...\n");
+	ret = event_loop_run(loop);
+	if (ret < 0)
+		fprintf(stderr, "event error\n");
+
+	/* Stop the output thread first, its statistics are final then. */
+	if (pipeline)
+		pipeline_stop(pipeline);
+	dump_stats();
+
+pipeline_fail:
+	pipeline_free(pipeline);
+	pipeline = NULL;
+loop_setup_fail:
+	stats_file_stop(stats_file);
+	fusion_free(fusion);
+	hotplug_free(hotplug);
+	event_loop_free(loop);
+loop_fail:
 	remove_scroller(slider_y);
 slider_y_fail:
 	remove_scroller(slider_x);
 out:
-	close(i2c_fd);
-	return EXIT_FAILURE;
+	is31fl3728_close(&matrix);
+	return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
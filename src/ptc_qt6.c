@@ -19,91 +19,187 @@
 
 #include <errno.h>
 #include <fcntl.h>
-#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 
 #include <libevdev-1.0/libevdev/libevdev.h>
 
+#include "event_loop.h"
+#include "fusion.h"
+#include "hotplug.h"
+#include "launcher.h"
 #include "ptc_qt.h"
+#include "rt.h"
+#include "stats_file.h"
 
 #define SLIDER_X_INPUT_FILE	"/dev/input/atmel_ptc0"
 #define SLIDER_Y_INPUT_FILE	"/dev/input/atmel_ptc1"
-#define POLL_NFDS		2
 
-static void slider_position_update(struct gpio_led_desc *leds, unsigned int nleds,
-				    unsigned int ev_type, unsigned int ev_value,
-				    void *arg)
+static struct scroller *slider_x, *slider_y;
+static unsigned int pos_x, pos_y;
+static struct hotplug *hotplug;
+static struct fusion *fusion;
+static struct stats_file *stats_file;
+
+/* One line per X/Y sample. */
+static int fused_output(const struct fusion_sample *sample, void *arg)
+{
+	printf("x=%u - y=%u\n", sample->position[0], sample->position[1]);
+	return 0;
+}
+
+static void slider_frame_update(struct scroller *scroller,
+				const struct scroller_frame *frame, void *arg)
 {
 	unsigned int *position = arg;
 
-	if (ev_type == EV_KEY)
-		if (ev_value == 0)
-			*position = 0;
+	scroller_position_frame_update(scroller, frame, arg);
+	fusion_update(fusion, position == &pos_y, &frame->time,
+		      scroller->touched, *position);
+}
+
+static int slider_x_handler(int fd, uint32_t events, void *arg)
+{
+	return scroller_event_handler(arg, &pos_x);
+}
+
+static int slider_y_handler(int fd, uint32_t events, void *arg)
+{
+	return scroller_event_handler(arg, &pos_y);
+}
+
+static int quit_handler(int signo, void *arg)
+{
+	return 1;
+}
+
+static void write_counters(FILE *f, void *arg)
+{
+	scroller_print_counters(slider_x, f, "slider_x");
+	scroller_print_counters(slider_y, f, "slider_y");
+	if (fusion)
+		fprintf(f, "fusion frames=%lu samples=%lu pairs=%lu\n",
+			fusion->frames, fusion->samples, fusion->paired);
+}
+
+static void dump_stats(void)
+{
+	write_counters(stderr, NULL);
+	scroller_print_latency(slider_x, stderr, "slider x");
+	scroller_print_latency(slider_y, stderr, "slider y");
+	if (hotplug)
+		hotplug_print_stats(hotplug, stderr);
+}
 
-	if (ev_type == EV_ABS)
-		*position = ev_value;
+static int stats_handler(int signo, void *arg)
+{
+	dump_stats();
+	if (stats_file)
+		stats_file_refresh(stats_file);
+	return 0;
 }
 
-int main(void)
+static void usage(const char *prog)
 {
-	struct scroller *slider_x, *slider_y;
-	int pos_x = 0, pos_y = 0, ret, i;
-	struct pollfd fds[POLL_NFDS];
+	fprintf(stderr, "usage: %s [options]\noptions:\n"
+		"  -e ms       display the touch position this far ahead (prediction)\n"
+		FUSION_USAGE
+		STATS_FILE_USAGE LAUNCHER_USAGE RT_USAGE, prog);
+}
+
+int main(int argc, char **argv)
+{
+	static const char * const input_files[] = {
+		SLIDER_X_INPUT_FILE, SLIDER_Y_INPUT_FILE,
+	};
+	struct launcher launcher = LAUNCHER_INIT;
+	struct event_loop *loop;
+	struct rt_options rt = RT_OPTIONS_INIT;
+	const char *stats_path = NULL;
+	unsigned int lead_ms = 0, window_us = FUSION_DEFAULT_WINDOW_US;
+	int opt, ret = -1;
+
+	while ((opt = getopt(argc, argv, "e:w:o:" LAUNCHER_OPTSTRING RT_OPTSTRING)) != -1) {
+		if (opt == 'e') {
+			lead_ms = strtoul(optarg, NULL, 0);
+		} else if (opt == 'w') {
+			window_us = strtoul(optarg, NULL, 0);
+		} else if (opt == 'o') {
+			stats_path = optarg;
+		} else if (opt == 'l') {
+			launcher.config = optarg;
+		} else if (rt_parse_option(&rt, opt, optarg)) {
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
 
-	slider_x = initialize_scroller(SLIDER_X_INPUT_FILE, NULL, 0,
-				       slider_position_update);
+	if (launcher_start(&launcher, input_files, 2))
+		return EXIT_FAILURE;
+
+	slider_x = initialize_scroller_frames(SLIDER_X_INPUT_FILE, NULL, 0,
+					      slider_frame_update);
 	if (!slider_x)
 		goto out;
 
-	slider_y = initialize_scroller(SLIDER_Y_INPUT_FILE, NULL, 0,
-				       slider_position_update);
+	slider_y = initialize_scroller_frames(SLIDER_Y_INPUT_FILE, NULL, 0,
+					      slider_frame_update);
 	if (!slider_y)
 		goto slider_y_fail;
 
-	fds[0].fd = slider_x->fd;
-	fds[0].events = POLLIN;
-	fds[1].fd = slider_y->fd;
-	fds[1].events = POLLIN;
-
-	printf("demo running...\n");
-	while (1) {
-		ret = poll(fds, POLL_NFDS, - 1);
-		if (ret < 0) {
-			fprintf(stderr, "poll() failed\n");
-			break;
-		}
+	if (scroller_set_prediction(slider_x, lead_ms, false) ||
+	    scroller_set_prediction(slider_y, lead_ms, false))
+		goto loop_fail;
+
+	loop = event_loop_new();
+	if (!loop)
+		goto loop_fail;
+
+	fusion = fusion_new(loop, window_us, fused_output, NULL);
+	if (!fusion)
+		goto loop_setup_fail;
+
+	hotplug = hotplug_new(loop);
+	if (!hotplug ||
+	    hotplug_add_scroller(hotplug, slider_x, SLIDER_X_INPUT_FILE,
+				 slider_x_handler, slider_x) ||
+	    hotplug_add_scroller(hotplug, slider_y, SLIDER_Y_INPUT_FILE,
+				 slider_y_handler, slider_y) ||
+	    !event_loop_add_signal(loop, SIGINT, 0, quit_handler, NULL) ||
+	    !event_loop_add_signal(loop, SIGTERM, 0, quit_handler, NULL) ||
+	    !event_loop_add_signal(loop, SIGUSR1, 0, stats_handler, NULL))
+		goto loop_setup_fail;
+
+	if (stats_path) {
+		stats_file = stats_file_start(loop, stats_path, STATS_FILE_PERIOD_MS,
+					      write_counters, NULL);
+		if (!stats_file)
+			goto loop_setup_fail;
+	}
 
-		for (i = 0; i < POLL_NFDS; i++) {
-			if (fds[i].revents == 0)
-				continue;
-
-			if (fds[i].revents != POLLIN) {
-				fprintf(stderr, "error, revents = %d\n", fds[i].revents);
-				break;
-			}
-
-			if (fds[i].fd == slider_x->fd) {
-				ret = scroller_event_handler(slider_x, &pos_x);
-				if (ret)
-					break;
-			}
-
-			if (fds[i].fd == slider_y->fd) {
-				ret = scroller_event_handler(slider_y, &pos_y);
-				if (ret)
-					break;
-			}
-		}
+	/* Reported, but not fatal: the demo still works, with more jitter. */
+	rt_apply(&rt);
 
-		printf("x=%d - y=%d\n", pos_x, pos_y);
-	}
-	fprintf(stderr, "event error\n");
+	launcher_ready(&launcher);
 
+	printf("demo running...\n");
+	ret = event_loop_run(loop);
+	if (ret < 0)
+		fprintf(stderr, "event error\n");
+
+	dump_stats();
+
+loop_setup_fail:
+	stats_file_stop(stats_file);
+	fusion_free(fusion);
+	hotplug_free(hotplug);
+	event_loop_free(loop);
+loop_fail:
 	remove_scroller(slider_y);
 slider_y_fail:
 	remove_scroller(slider_x);
 out:
-	return EXIT_FAILURE;
+	return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
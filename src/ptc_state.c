@@ -0,0 +1,91 @@
+/*
+ * Print the device states published by ptc_daemon -s.
+ *
+ * Also an example of a reader: once the segment is mapped, reading the
+ * states is a few memory loads, polling them costs no syscall.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "state_shm.h"
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [options] [name]\n"
+		"  name        shared memory segment (default " STATE_SHM_DEFAULT_NAME ")\n"
+		"options:\n"
+		"  -i ms       poll interval (default 20)\n"
+		"  -1          print the states once and exit\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t seen[STATE_SHM_MAX_DEVICES] = { 0 };
+	const char *name = STATE_SHM_DEFAULT_NAME;
+	const struct state_shm *shm;
+	struct state_shm_data data;
+	unsigned int interval_ms = 20, i;
+	struct timespec interval;
+	bool once = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "i:1")) != -1) {
+		switch (opt) {
+		case 'i':
+			interval_ms = strtoul(optarg, NULL, 0);
+			break;
+		case '1':
+			once = true;
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind < argc)
+		name = argv[optind];
+
+	shm = state_shm_open(name);
+	if (!shm)
+		return EXIT_FAILURE;
+
+	interval.tv_sec = interval_ms / 1000;
+	interval.tv_nsec = interval_ms % 1000 * 1000000L;
+
+	while (atomic_load_explicit(&shm->running, memory_order_relaxed)) {
+		for (i = 0; i < shm->ndevices; i++) {
+			const struct state_shm_device *dev = &shm->devices[i];
+
+			if (!state_shm_read(dev, &data)) {
+				fprintf(stderr, "%s: no consistent state\n", dev->name);
+				continue;
+			}
+
+			/* Only the changes, unless printing once. */
+			if (!once && data.updates == seen[i])
+				continue;
+			seen[i] = data.updates;
+
+			printf("%s (%s): keys=0x%x x=%d y=%d time=%llu.%06llu\n",
+			       dev->name, dev->type, data.keys, data.position[0],
+			       data.position[1],
+			       (unsigned long long)data.time_us / 1000000,
+			       (unsigned long long)data.time_us % 1000000);
+		}
+		fflush(stdout);
+
+		if (once)
+			break;
+		nanosleep(&interval, NULL);
+	}
+
+	if (!once)
+		fprintf(stderr, "%s: writer %d exited\n", name, shm->pid);
+
+	state_shm_close(shm);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,334 @@
+/*
+ * Record and replay the event streams of the PTC input devices.
+ *
+ * record reads the raw events of the atmel_ptc devices into a binary trace
+ * (see event_trace.h). replay recreates the devices with uinput and feeds
+ * them the recorded events, at the recorded pace, faster, or as fast as
+ * possible, so that the demos and the benchmarks run on real touch data.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libevdev-1.0/libevdev/libevdev.h>
+
+#include "event_loop.h"
+#include "event_trace.h"
+
+#define TRACE_FLUSH_PERIOD_MS	1000
+#define TRACE_READ_EVENTS	256
+
+static const char *default_devices[] = {
+	"/dev/input/atmel_ptc0",
+	"/dev/input/atmel_ptc1",
+	"/dev/input/atmel_ptc2",
+};
+
+struct trace_input {
+	int fd;
+	unsigned int index;
+	struct event_trace_writer *writer;
+};
+
+static int trace_input_handler(int fd, uint32_t events, void *arg)
+{
+	struct input_event buf[TRACE_READ_EVENTS];
+	struct trace_input *input = arg;
+	ssize_t len;
+
+	for (;;) {
+		len = read(fd, buf, sizeof(buf));
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				return 0;
+			fprintf(stderr, "Can't read device %u: %s\n",
+				input->index, strerror(errno));
+			return -1;
+		}
+		if (!len)
+			return 0;
+
+		if (event_trace_write(input->writer, input->index, buf,
+				      len / sizeof(buf[0])))
+			return -1;
+	}
+}
+
+static int trace_flush_handler(void *arg)
+{
+	return event_trace_writer_flush(arg);
+}
+
+static int trace_quit_handler(int signo, void *arg)
+{
+	return 1;
+}
+
+static int trace_record(const char *path, const char **files, unsigned int nfiles)
+{
+	struct trace_input inputs[EVENT_TRACE_MAX_DEVICES];
+	struct libevdev *evdevs[EVENT_TRACE_MAX_DEVICES];
+	const char *paths[EVENT_TRACE_MAX_DEVICES];
+	struct event_trace_writer writer = { 0 };
+	struct event_loop *loop = NULL;
+	unsigned int i, n = 0;
+	int fd, ret = -1;
+
+	for (i = 0; i < nfiles && n < EVENT_TRACE_MAX_DEVICES; i++) {
+		fd = open(files[i], O_RDONLY | O_NONBLOCK);
+		if (fd < 0) {
+			fprintf(stderr, "Skipping %s: %s\n", files[i], strerror(errno));
+			continue;
+		}
+
+		if (libevdev_new_from_fd(fd, &evdevs[n]) < 0) {
+			fprintf(stderr, "Failed to init libevdev for %s\n", files[i]);
+			close(fd);
+			continue;
+		}
+
+		/* Same clock as the demos, so that latencies can be compared. */
+		if (libevdev_set_clock_id(evdevs[n], CLOCK_MONOTONIC))
+			fprintf(stderr, "Can't use the monotonic clock for %s\n",
+				files[i]);
+
+		inputs[n].fd = fd;
+		inputs[n].index = n;
+		inputs[n].writer = &writer;
+		paths[n] = files[i];
+		n++;
+	}
+
+	if (!n) {
+		fprintf(stderr, "No device to record\n");
+		return -1;
+	}
+
+	if (event_trace_writer_open(&writer, path, evdevs, paths, n))
+		goto out;
+
+	loop = event_loop_new();
+	if (!loop)
+		goto out;
+
+	for (i = 0; i < n; i++)
+		if (!event_loop_add_fd(loop, inputs[i].fd, 0, 1,
+				       trace_input_handler, &inputs[i]))
+			goto out;
+
+	if (!event_loop_add_timer(loop, TRACE_FLUSH_PERIOD_MS, 0,
+				  trace_flush_handler, &writer) ||
+	    !event_loop_add_signal(loop, SIGINT, 2, trace_quit_handler, NULL) ||
+	    !event_loop_add_signal(loop, SIGTERM, 2, trace_quit_handler, NULL))
+		goto out;
+
+	fprintf(stderr, "Recording %u device(s) to %s, ^C to stop\n", n, path);
+	if (event_loop_run(loop) < 0)
+		goto out;
+
+	fprintf(stderr, "%lu events recorded\n", writer.nrecords);
+	ret = 0;
+
+out:
+	event_loop_free(loop);
+	event_trace_writer_close(&writer);
+	for (i = 0; i < n; i++) {
+		libevdev_free(evdevs[i]);
+		close(inputs[i].fd);
+	}
+
+	return ret;
+}
+
+/*
+ * Point link_dir/atmel_ptcN at the replayed devices, like the udev rules do
+ * for the real ones, so that the demos find them.
+ */
+static int trace_link_devices(const char *link_dir, struct uinput_device *devs,
+			      unsigned int ndevices)
+{
+	char link[PATH_MAX];
+	unsigned int i;
+
+	for (i = 0; i < ndevices; i++) {
+		snprintf(link, sizeof(link), "%s/atmel_ptc%u", link_dir, i);
+		unlink(link);
+		if (symlink(devs[i].event_file, link)) {
+			fprintf(stderr, "Can't link %s: %s\n", link, strerror(errno));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void trace_unlink_devices(const char *link_dir, unsigned int ndevices)
+{
+	char link[PATH_MAX];
+	unsigned int i;
+
+	for (i = 0; i < ndevices; i++) {
+		snprintf(link, sizeof(link), "%s/atmel_ptc%u", link_dir, i);
+		unlink(link);
+	}
+}
+
+static int trace_replay(const char *path, double speed, const char *link_dir,
+			unsigned int wait)
+{
+	struct uinput_device devs[EVENT_TRACE_MAX_DEVICES];
+	struct event_trace trace;
+	unsigned int i, ndevices;
+	int ret = -1;
+
+	if (event_trace_open(&trace, path))
+		return -1;
+
+	ndevices = trace.header->ndevices;
+	if (event_trace_create_devices(&trace, devs))
+		goto out;
+
+	if (link_dir && trace_link_devices(link_dir, devs, ndevices))
+		goto out_devices;
+
+	for (i = 0; i < ndevices; i++)
+		fprintf(stderr, "%s (%s) replayed on %s\n",
+			trace.header->devices[i].path,
+			trace.header->devices[i].name, devs[i].event_file);
+
+	sleep(wait);
+
+	ret = event_trace_replay(&trace, devs, speed);
+	if (!ret)
+		fprintf(stderr, "%zu events replayed\n", trace.nrecords);
+
+	if (link_dir)
+		trace_unlink_devices(link_dir, ndevices);
+out_devices:
+	event_trace_destroy_devices(&trace, devs);
+out:
+	event_trace_close(&trace);
+	return ret;
+}
+
+static int trace_info(const char *path)
+{
+	const struct event_trace_device *desc;
+	unsigned long long first_us, last_us;
+	struct event_trace trace;
+	unsigned int i, j;
+	size_t k;
+
+	if (event_trace_open(&trace, path))
+		return -1;
+
+	for (i = 0; i < trace.header->ndevices; i++) {
+		desc = &trace.header->devices[i];
+		printf("device %u: %s \"%s\" bus 0x%x vendor 0x%x product 0x%x\n",
+		       i, desc->path, desc->name, desc->id.bustype,
+		       desc->id.vendor, desc->id.product);
+		for (j = 0; j < desc->nkeys; j++)
+			printf("  key %u\n", desc->keys[j]);
+		for (j = 0; j < desc->nabs; j++)
+			printf("  abs %u [%d, %d]\n", desc->abs[j].code,
+			       desc->abs[j].info.minimum, desc->abs[j].info.maximum);
+	}
+
+	printf("%zu events", trace.nrecords);
+	if (trace.nrecords) {
+		/* The devices are interleaved, their timestamps too. */
+		first_us = last_us = trace.records[0].time_us;
+		for (k = 1; k < trace.nrecords; k++) {
+			if (trace.records[k].time_us < first_us)
+				first_us = trace.records[k].time_us;
+			if (trace.records[k].time_us > last_us)
+				last_us = trace.records[k].time_us;
+		}
+		printf(" over %.3f s", (last_us - first_us) / 1e6);
+	}
+	printf("\n");
+
+	event_trace_close(&trace);
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s record [-o file] [device...]\n"
+		"       %s replay [-s speed | -f] [-l dir] [-w seconds] file\n"
+		"       %s info file\n"
+		"options:\n"
+		"  -o file     trace to write (default ptc.trace)\n"
+		"  -s speed    replay speed factor (default 1)\n"
+		"  -f          replay as fast as possible\n"
+		"  -l dir      create atmel_ptcN links to the replayed devices in dir\n"
+		"  -w seconds  wait before replaying, to start the consumers\n"
+		"record defaults to /dev/input/atmel_ptc0 to atmel_ptc2.\n",
+		prog, prog, prog);
+}
+
+int main(int argc, char **argv)
+{
+	const char *output = "ptc.trace", *link_dir = NULL, *cmd;
+	unsigned int wait = 0;
+	double speed = 1.0;
+	int opt, ret;
+
+	if (argc < 2) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	cmd = argv[1];
+	optind = 2;
+
+	while ((opt = getopt(argc, argv, "o:s:fl:w:h")) != -1) {
+		switch (opt) {
+		case 'o':
+			output = optarg;
+			break;
+		case 's':
+			speed = strtod(optarg, NULL);
+			break;
+		case 'f':
+			speed = 0;
+			break;
+		case 'l':
+			link_dir = optarg;
+			break;
+		case 'w':
+			wait = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (!strcmp(cmd, "record")) {
+		if (optind < argc)
+			ret = trace_record(output, (const char **)&argv[optind],
+					   argc - optind);
+		else
+			ret = trace_record(output, default_devices,
+					   sizeof(default_devices) / sizeof(default_devices[0]));
+	} else if (!strcmp(cmd, "replay") && optind < argc) {
+		ret = trace_replay(argv[optind], speed, link_dir, wait);
+	} else if (!strcmp(cmd, "info") && optind < argc) {
+		ret = trace_info(argv[optind]);
+	} else {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
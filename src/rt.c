@@ -0,0 +1,133 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <malloc.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "rt.h"
+
+/* Memory touched at startup so that the event path never page faults. */
+#define RT_STACK_PREFAULT	(256 * 1024)
+#define RT_HEAP_PREFAULT	(1024 * 1024)
+
+int rt_parse_option(struct rt_options *opts, int opt, const char *arg)
+{
+	switch (opt) {
+	case 'p':
+		opts->priority = strtol(arg, NULL, 0);
+		if (opts->priority < sched_get_priority_min(SCHED_FIFO) ||
+		    opts->priority > sched_get_priority_max(SCHED_FIFO)) {
+			fprintf(stderr, "Invalid SCHED_FIFO priority %s\n", arg);
+			return -1;
+		}
+		return 0;
+	case 'c':
+		opts->cpu = strtol(arg, NULL, 0);
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+static void rt_prefault_stack(void)
+{
+	volatile char stack[RT_STACK_PREFAULT];
+	size_t i;
+
+	for (i = 0; i < sizeof(stack); i += 4096)
+		stack[i] = 0;
+}
+
+/*
+ * Grow the heap once and keep it: freed memory is not given back to the
+ * kernel and large blocks are not served by separate mappings anymore.
+ */
+static int rt_prefault_heap(void)
+{
+	char *heap;
+
+	if (!mallopt(M_TRIM_THRESHOLD, -1) || !mallopt(M_MMAP_MAX, 0))
+		return -1;
+
+	heap = malloc(RT_HEAP_PREFAULT);
+	if (!heap)
+		return -1;
+
+	memset(heap, 0, RT_HEAP_PREFAULT);
+	free(heap);
+	return 0;
+}
+
+/*
+ * Apply the realtime options to the calling process. Each step is reported,
+ * a step that can't be applied, usually for lack of privileges or of
+ * RLIMIT_RTPRIO/RLIMIT_MEMLOCK, is reported and the others still applied.
+ * Returns -1 if any step failed.
+ */
+int rt_apply(const struct rt_options *opts)
+{
+	struct sched_param param = { .sched_priority = opts->priority };
+	cpu_set_t cpus;
+	int ret = 0;
+
+	if (opts->cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(opts->cpu, &cpus);
+		if (sched_setaffinity(0, sizeof(cpus), &cpus)) {
+			fprintf(stderr, "rt: can't run on CPU %d: %s\n",
+				opts->cpu, strerror(errno));
+			ret = -1;
+		} else {
+			fprintf(stderr, "rt: running on CPU %d\n", opts->cpu);
+		}
+	}
+
+	if (!opts->priority)
+		return ret;
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE)) {
+		fprintf(stderr, "rt: can't lock memory: %s\n", strerror(errno));
+		ret = -1;
+	} else if (rt_prefault_heap()) {
+		fprintf(stderr, "rt: can't prefault the heap\n");
+		ret = -1;
+	} else {
+		rt_prefault_stack();
+		fprintf(stderr, "rt: memory locked, %d KiB of heap and %d KiB of stack prefaulted\n",
+			RT_HEAP_PREFAULT / 1024, RT_STACK_PREFAULT / 1024);
+	}
+
+	if (sched_setscheduler(0, SCHED_FIFO, &param)) {
+		fprintf(stderr, "rt: can't use SCHED_FIFO priority %d: %s\n",
+			opts->priority, strerror(errno));
+		ret = -1;
+	} else {
+		fprintf(stderr, "rt: SCHED_FIFO priority %d\n", opts->priority);
+	}
+
+	return ret;
+}
+
+/*
+ * Put the calling thread back to the default policy on any CPU, for helper
+ * threads that must not compete with the realtime one. Linux applies the
+ * policy and the affinity per thread.
+ */
+void rt_thread_default(void)
+{
+	struct sched_param param = { .sched_priority = 0 };
+	cpu_set_t cpus;
+	long i, n;
+
+	sched_setscheduler(0, SCHED_OTHER, &param);
+
+	n = sysconf(_SC_NPROCESSORS_CONF);
+	CPU_ZERO(&cpus);
+	for (i = 0; i < n && i < CPU_SETSIZE; i++)
+		CPU_SET(i, &cpus);
+	sched_setaffinity(0, sizeof(cpus), &cpus);
+}
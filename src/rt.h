@@ -0,0 +1,23 @@
+#ifndef _RT_H
+#define _RT_H
+
+/*
+ * Realtime execution mode: SCHED_FIFO priority with memory locked and
+ * prefaulted, and CPU affinity. Both are off by default.
+ */
+struct rt_options {
+	int priority;
+	int cpu;
+};
+
+#define RT_OPTIONS_INIT		{ .priority = 0, .cpu = -1 }
+#define RT_OPTSTRING		"p:c:"
+#define RT_USAGE \
+	"  -p priority run with this SCHED_FIFO priority, memory locked\n" \
+	"  -c cpu      run on this CPU only\n"
+
+int rt_parse_option(struct rt_options *opts, int opt, const char *arg);
+int rt_apply(const struct rt_options *opts);
+void rt_thread_default(void);
+
+#endif /* _RT_H */
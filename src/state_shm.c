@@ -0,0 +1,110 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "state_shm.h"
+
+/*
+ * Create, or take over, the segment of the writer. The header is filled in
+ * last, readers mapping it earlier see a bad magic and retry.
+ */
+struct state_shm *state_shm_create(const char *name, unsigned int ndevices)
+{
+	struct state_shm *shm;
+	int fd;
+
+	if (ndevices > STATE_SHM_MAX_DEVICES) {
+		fprintf(stderr, "%s: %u devices, at most %d published\n", name,
+			ndevices, STATE_SHM_MAX_DEVICES);
+		ndevices = STATE_SHM_MAX_DEVICES;
+	}
+
+	fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "Can't create %s: %s\n", name, strerror(errno));
+		return NULL;
+	}
+
+	if (ftruncate(fd, sizeof(*shm))) {
+		fprintf(stderr, "Can't size %s: %s\n", name, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED) {
+		fprintf(stderr, "Can't map %s: %s\n", name, strerror(errno));
+		return NULL;
+	}
+
+	shm->magic = 0;
+	atomic_thread_fence(memory_order_release);
+	memset(shm->devices, 0, sizeof(shm->devices));
+	shm->version = STATE_SHM_VERSION;
+	shm->ndevices = ndevices;
+	shm->pid = getpid();
+	atomic_store(&shm->running, 1);
+	atomic_thread_fence(memory_order_release);
+	shm->magic = STATE_SHM_MAGIC;
+
+	return shm;
+}
+
+void state_shm_destroy(struct state_shm *shm, const char *name)
+{
+	if (!shm)
+		return;
+
+	atomic_store(&shm->running, 0);
+	munmap(shm, sizeof(*shm));
+	shm_unlink(name);
+}
+
+const struct state_shm *state_shm_open(const char *name)
+{
+	struct state_shm *shm;
+	uint32_t magic;
+	struct stat st;
+	int fd;
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) {
+		fprintf(stderr, "Can't open %s: %s\n", name, strerror(errno));
+		return NULL;
+	}
+
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof(*shm)) {
+		fprintf(stderr, "%s: not a PTC state segment\n", name);
+		close(fd);
+		return NULL;
+	}
+
+	shm = mmap(NULL, sizeof(*shm), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED) {
+		fprintf(stderr, "Can't map %s: %s\n", name, strerror(errno));
+		return NULL;
+	}
+
+	magic = shm->magic;
+	atomic_thread_fence(memory_order_acquire);
+	if (magic != STATE_SHM_MAGIC || shm->version != STATE_SHM_VERSION) {
+		fprintf(stderr, "%s: not a PTC state segment, or of another version\n",
+			name);
+		munmap(shm, sizeof(*shm));
+		return NULL;
+	}
+
+	return shm;
+}
+
+void state_shm_close(const struct state_shm *shm)
+{
+	if (shm)
+		munmap((void *)shm, sizeof(*shm));
+}
@@ -0,0 +1,90 @@
+#ifndef _STATE_SHM_H
+#define _STATE_SHM_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+/*
+ * Live touch state published in a POSIX shared memory segment (/dev/shm),
+ * for other processes to read at any rate without opening the input
+ * devices nor making any syscall once it is mapped.
+ *
+ * Each device is guarded by its own seqlock: the writer, a single thread,
+ * makes seq odd while it updates the data and even again when done. A
+ * reader retries while seq is odd or changed during its copy. Publishing
+ * is a few stores, without syscall nor lock.
+ */
+#define STATE_SHM_DEFAULT_NAME	"/ptc_state"
+#define STATE_SHM_MAGIC		0x53435450	/* "PTCS" */
+#define STATE_SHM_VERSION	1
+#define STATE_SHM_MAX_DEVICES	8
+/* A writer killed while updating would leave seq odd for good. */
+#define STATE_SHM_READ_RETRIES	10000
+
+struct state_shm_data {
+	/* Event timestamp of the last update, CLOCK_MONOTONIC. */
+	uint64_t time_us;
+	/* Buttons: bit i for the i-th key code. Scrollers: bit 0, touched. */
+	uint32_t keys;
+	/* Slider or wheel position in position[0], 2D surfaces use both. */
+	int32_t position[2];
+	uint64_t updates;
+};
+
+struct state_shm_device {
+	_Alignas(64) atomic_uint seq;
+	char name[32];
+	char type[16];
+	struct state_shm_data data;
+};
+
+struct state_shm {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t ndevices;
+	/* Cleared when the writer exits. */
+	atomic_uint running;
+	pid_t pid;
+	struct state_shm_device devices[STATE_SHM_MAX_DEVICES];
+};
+
+static inline void state_shm_publish(struct state_shm_device *dev,
+				     const struct state_shm_data *data)
+{
+	unsigned int seq = atomic_load_explicit(&dev->seq, memory_order_relaxed);
+
+	atomic_store_explicit(&dev->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	memcpy(&dev->data, data, sizeof(*data));
+	atomic_store_explicit(&dev->seq, seq + 2, memory_order_release);
+}
+
+/* Consistent copy of the state of a device, false if none could be made. */
+static inline bool state_shm_read(const struct state_shm_device *dev,
+				  struct state_shm_data *data)
+{
+	unsigned int seq, i;
+
+	for (i = 0; i < STATE_SHM_READ_RETRIES; i++) {
+		seq = atomic_load_explicit(&dev->seq, memory_order_acquire);
+		if (seq & 1)
+			continue;
+
+		memcpy(data, &dev->data, sizeof(*data));
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&dev->seq, memory_order_relaxed) == seq)
+			return true;
+	}
+
+	return false;
+}
+
+struct state_shm *state_shm_create(const char *name, unsigned int ndevices);
+void state_shm_destroy(struct state_shm *shm, const char *name);
+const struct state_shm *state_shm_open(const char *name);
+void state_shm_close(const struct state_shm *shm);
+
+#endif /* _STATE_SHM_H */
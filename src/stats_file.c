@@ -0,0 +1,90 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "event_loop.h"
+#include "latency.h"
+#include "stats_file.h"
+
+int stats_file_refresh(struct stats_file *stats)
+{
+	FILE *f;
+
+	f = fopen(stats->tmp_path, "w");
+	if (!f)
+		goto fail;
+
+	fprintf(f, "time_us %llu\n", latency_now_us());
+	stats->write(f, stats->arg);
+
+	if (fclose(f) || rename(stats->tmp_path, stats->path)) {
+		unlink(stats->tmp_path);
+		goto fail;
+	}
+
+	stats->refreshes++;
+	return 0;
+
+fail:
+	/* Reported once: the export keeps being retried, quietly. */
+	if (!stats->failures++)
+		fprintf(stderr, "Can't write %s: %s\n", stats->path, strerror(errno));
+	return -1;
+}
+
+/* A failed export doesn't stop the loop. */
+static int stats_file_timer_handler(void *arg)
+{
+	stats_file_refresh(arg);
+	return 0;
+}
+
+struct stats_file *stats_file_start(struct event_loop *loop, const char *path,
+	unsigned int period_ms, void (*write)(FILE *f, void *arg), void *arg)
+{
+	struct stats_file *stats;
+
+	stats = calloc(1, sizeof(*stats));
+	if (!stats) {
+		fprintf(stderr, "Can't allocate stats file\n");
+		return NULL;
+	}
+
+	if (strlen(path) >= sizeof(stats->path)) {
+		fprintf(stderr, "%s: path too long\n", path);
+		goto out;
+	}
+	strcpy(stats->path, path);
+	snprintf(stats->tmp_path, sizeof(stats->tmp_path), "%s.tmp", path);
+	stats->loop = loop;
+	stats->write = write;
+	stats->arg = arg;
+
+	/* Reports at once a path which can't be written. */
+	if (stats_file_refresh(stats))
+		goto out;
+
+	stats->timer = event_loop_add_timer(loop, period_ms, 0,
+					    stats_file_timer_handler, stats);
+	if (!stats->timer)
+		goto out;
+
+	return stats;
+
+out:
+	free(stats);
+	return NULL;
+}
+
+/* The file is removed: its counters would be stale. */
+void stats_file_stop(struct stats_file *stats)
+{
+	if (!stats)
+		return;
+
+	event_loop_remove(stats->loop, stats->timer);
+	unlink(stats->path);
+	free(stats);
+}
@@ -0,0 +1,36 @@
+#ifndef _STATS_FILE_H
+#define _STATS_FILE_H
+
+#include <stdio.h>
+
+/*
+ * Export of the counters in a text file, e.g. under /run, rewritten every
+ * period_ms from the event loop: the write callback prints the counters,
+ * one "name key=value..." line per device, into a temporary file renamed
+ * over the previous one, so that readers always see a whole export.
+ */
+#define STATS_FILE_PERIOD_MS	1000
+#define STATS_FILE_USAGE \
+	"  -o file     write the counters to this file every second,\n" \
+	"              e.g. /run/ptc.stats\n"
+
+struct event_loop;
+struct event_source;
+
+struct stats_file {
+	char path[108];
+	char tmp_path[112];
+	struct event_loop *loop;
+	struct event_source *timer;
+	void (*write)(FILE *f, void *arg);
+	void *arg;
+	unsigned long refreshes;
+	unsigned long failures;
+};
+
+struct stats_file *stats_file_start(struct event_loop *loop, const char *path,
+	unsigned int period_ms, void (*write)(FILE *f, void *arg), void *arg);
+int stats_file_refresh(struct stats_file *stats);
+void stats_file_stop(struct stats_file *stats);
+
+#endif /* _STATS_FILE_H */
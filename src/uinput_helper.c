@@ -0,0 +1,144 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include <linux/uinput.h>
+
+#include "uinput_helper.h"
+
+/* Time given to devtmpfs/udev to create the event node. */
+#define UINPUT_NODE_TIMEOUT_MS	2000
+
+static int uinput_find_event_file(struct uinput_device *dev)
+{
+	struct timespec delay = { 0, 1000000 };
+	char sysname[32], path[96];
+	struct dirent *entry;
+	unsigned int i;
+	DIR *dir;
+
+	if (ioctl(dev->fd, UI_GET_SYSNAME(sizeof(sysname)), sysname) < 0) {
+		fprintf(stderr, "Can't get uinput device name: %s\n", strerror(errno));
+		return -1;
+	}
+
+	snprintf(path, sizeof(path), "/sys/devices/virtual/input/%s", sysname);
+	dir = opendir(path);
+	if (!dir) {
+		fprintf(stderr, "Can't open %s\n", path);
+		return -1;
+	}
+
+	dev->event_file[0] = '\0';
+	while ((entry = readdir(dir))) {
+		if (strncmp(entry->d_name, "event", strlen("event")))
+			continue;
+
+		/* Too long for an evdev node name: not one. */
+		if (snprintf(dev->event_file, sizeof(dev->event_file),
+			     "/dev/input/%s", entry->d_name) >= (int)sizeof(dev->event_file)) {
+			dev->event_file[0] = '\0';
+			continue;
+		}
+		break;
+	}
+	closedir(dir);
+
+	if (!dev->event_file[0]) {
+		fprintf(stderr, "No event node for %s\n", path);
+		return -1;
+	}
+
+	for (i = 0; i < UINPUT_NODE_TIMEOUT_MS; i++) {
+		if (!access(dev->event_file, R_OK))
+			return 0;
+		nanosleep(&delay, NULL);
+	}
+
+	fprintf(stderr, "%s did not show up\n", dev->event_file);
+	return -1;
+}
+
+int uinput_create(struct uinput_device *dev, const char *name,
+		  const struct input_id *id,
+		  const unsigned int *keys, unsigned int nkeys,
+		  const struct uinput_abs *abs, unsigned int nabs)
+{
+	struct uinput_abs_setup abs_setup;
+	struct uinput_setup setup;
+	unsigned int i;
+
+	dev->fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+	if (dev->fd < 0) {
+		fprintf(stderr, "Can't open /dev/uinput: %s\n", strerror(errno));
+		return -1;
+	}
+
+	if (nkeys && ioctl(dev->fd, UI_SET_EVBIT, EV_KEY) < 0)
+		goto out;
+	for (i = 0; i < nkeys; i++)
+		if (ioctl(dev->fd, UI_SET_KEYBIT, keys[i]) < 0)
+			goto out;
+
+	if (nabs && ioctl(dev->fd, UI_SET_EVBIT, EV_ABS) < 0)
+		goto out;
+	for (i = 0; i < nabs; i++) {
+		if (ioctl(dev->fd, UI_SET_ABSBIT, abs[i].code) < 0)
+			goto out;
+
+		memset(&abs_setup, 0, sizeof(abs_setup));
+		abs_setup.code = abs[i].code;
+		abs_setup.absinfo = abs[i].info;
+		if (ioctl(dev->fd, UI_ABS_SETUP, &abs_setup) < 0)
+			goto out;
+	}
+
+	memset(&setup, 0, sizeof(setup));
+	setup.id = *id;
+	snprintf(setup.name, sizeof(setup.name), "%s", name);
+	if (ioctl(dev->fd, UI_DEV_SETUP, &setup) < 0 ||
+	    ioctl(dev->fd, UI_DEV_CREATE) < 0)
+		goto out;
+
+	if (uinput_find_event_file(dev)) {
+		uinput_destroy(dev);
+		return -1;
+	}
+
+	return 0;
+
+out:
+	fprintf(stderr, "Can't set up uinput device %s: %s\n", name, strerror(errno));
+	close(dev->fd);
+	dev->fd = -1;
+	return -1;
+}
+
+void uinput_destroy(struct uinput_device *dev)
+{
+	if (dev->fd < 0)
+		return;
+
+	ioctl(dev->fd, UI_DEV_DESTROY);
+	close(dev->fd);
+	dev->fd = -1;
+}
+
+/* Inject events, all of them with a single write(). */
+int uinput_emit(struct uinput_device *dev, const struct input_event *events,
+		unsigned int nevents)
+{
+	ssize_t len = nevents * sizeof(*events);
+
+	if (write(dev->fd, events, len) != len) {
+		fprintf(stderr, "uinput write failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef _UINPUT_HELPER_H
+#define _UINPUT_HELPER_H
+
+#include <linux/input.h>
+
+struct uinput_abs {
+	unsigned int code;
+	struct input_absinfo info;
+};
+
+/*
+ * Synthetic input device created through /dev/uinput. event_file is the
+ * evdev node the kernel created for it, so that it can be opened like the
+ * atmel_ptc devices.
+ */
+struct uinput_device {
+	int fd;
+	char event_file[64];
+};
+
+int uinput_create(struct uinput_device *dev, const char *name,
+		  const struct input_id *id,
+		  const unsigned int *keys, unsigned int nkeys,
+		  const struct uinput_abs *abs, unsigned int nabs);
+void uinput_destroy(struct uinput_device *dev);
+int uinput_emit(struct uinput_device *dev, const struct input_event *events,
+		unsigned int nevents);
+
+#endif /* _UINPUT_HELPER_H */